@@ -47,7 +47,7 @@ int kbfd = 0;
 int is_europi = FALSE;	/* whether we are running on Europi hardware - set to True in hardware_init() */
 int print_messages = TRUE; /* controls whether log_msg outputs to std_err or not */
 int debug = TRUE;		/* controls whether debug messages are printed to the main screen */
-int impersonate_hw = FALSE; /*TRUE;	 Forces the software to bypass hardware checks (useful when testing sw without full hw ) */ 
+int impersonate_hw = FALSE; /*TRUE;	 Runs against a simulated I2C bus instead of the real hardware (useful when testing sw without full hw ) */ 
 char input_txt[100];    /* buffer for capturing user input */
 char current_filename[100]; /* The File we have Open, which is used in File-Save */
 char modal_dialog_txt1[50]; /* 1st Line of text for display in Modal Dialog box */
@@ -63,7 +63,6 @@ int midi_clock_divisor = 24; /* MIDI Clock pulses per step */
 int clock_counter = 95;	/* Main clock counter, tracks the 96 pulses per step */
 int clock_level = 0;	/* Master clock phase */
 int clock_source = INT_CLK;	/* INT_CLK = Internal, EXT_CLK = External Clock Source */
-int clock_freq=192;		/* speed of the main internal clock in Hz */
 int TuningOn = FALSE;    //FALSE;   /* when True, all CV ports will output the same Raw voltage */
 uint16_t TuningVoltage = 0;   /* raw value that is output when Tuning flag is Set */
 uint8_t PCF8574_state=0xF0; /* current state of the PCF8574 Ports on the Europi */
@@ -77,7 +76,7 @@ int edit_step = 1;      /* step being edited */
 int SingleChannelOffset = 0; /* first step displayed in Single Channel View */
 uint32_t step_tick = 0;	/* used to record the start point of each step in ticks */
 uint32_t step_ticks = 250000;	/* Records the length of each step in ticks (used to limit slew length) Init value of 250000 is so it doesn't go nuts */
-uint32_t slew_interval = 1000; /* number of microseconds between each sucessive level change during a slew */
+uint32_t slew_interval = 1000; /* number of microseconds between each sucessive level change during a slew - set by the ramp governor */
 /* global variables used by the touchscreen interface */
 Vector2 touchPosition = { 0, 0 };
 int currentGesture;
@@ -119,7 +118,17 @@ uint32_t encoder_tick;
 pthread_attr_t detached_attr;		/* Single detached thread attribute used by any /all detached threads */
 pthread_mutex_t mcp23008_lock;
 pthread_mutex_t pcf8574_lock;
-uint8_t mcp23008_state[16];
+uint8_t mcp23008_state[I2C_MAX_HANDLES];
+uint8_t mcp23008_dirty[I2C_MAX_HANDLES];       /* MCP23008s with staged gate changes that haven't been written yet */
+int pcf8574_dirty = FALSE;          /* PCF8574 has staged gate changes that haven't been written yet */
+unsigned pcf8574_handle;            /* Handle the staged PCF8574 changes are to be written to */
+pthread_mutex_t dac8574_lock;
+uint16_t dac8574_value[I2C_MAX_HANDLES][4];   /* DAC8574 channel values staged but not yet written */
+uint8_t dac8574_dirty[I2C_MAX_HANDLES];       /* Bitmap of staged channels on each DAC8574 */
+uint8_t dac8574_address[I2C_MAX_HANDLES];     /* Address of each DAC8574 with staged channels */
+uint32_t dac8574_out[I2C_MAX_HANDLES][4];     /* Output cache (OUT_ bits) for each DAC8574 channel */
+uint32_t mcp23008_out[I2C_MAX_HANDLES];       /* Output cache for each MCP23008 port */
+uint32_t pcf8574_out;                         /* Output cache for the PCF8574 port */
 char **files;                       // Filled with a list of filenames in a directory by file_list( )
 size_t file_count;                      
 int file_selected;
@@ -172,11 +181,19 @@ menu mnu_config_setzero = {0,0,dir_left,"Set Zero",&config_setzero,{NULL}};
 menu mnu_config_set10v = {0,0,dir_left,"Set 10 Volt",&config_setten,{NULL}};
 menu mnu_config_debug = {0,0,dir_left,"Debug on/off",&config_debug,{NULL}};
 menu mnu_config_tune = {0,0,dir_left,"Tuning on/off",&config_tune,{NULL}};
+menu mnu_config_i2cstats = {0,0,dir_left,"Dump I2C stats",&config_i2cstats,{NULL}};
 
 menu mnu_test_scalevalue = {0,0,dir_left,"Test scale value",&test_scalevalue,{NULL}};
 menu mnu_test_keyboard = {0,0,dir_left,"Test Keyboard",&test_keyboard,{NULL}};
 
 menu mnu_play_step_one = {0,0,dir_left,"Step One",&set_step_one,{NULL}};
+menu mnu_play_edits_step = {0,0,dir_left,"Edits on Step",&set_edits_on_step,{NULL}};
+menu mnu_play_edits_bar = {0,0,dir_left,"Edits on Bar",&set_edits_on_bar,{NULL}};
+menu mnu_play_store_pattern = {0,0,dir_left,"Store Pattern",&store_pattern,{NULL}};
+menu mnu_play_next_pattern = {0,0,dir_left,"Next Pattern",&next_pattern,{NULL}};
+menu mnu_play_prev_pattern = {0,0,dir_left,"Prev Pattern",&prev_pattern,{NULL}};
+menu mnu_play_chain_pattern = {0,0,dir_left,"Chain to Next",&chain_pattern,{NULL}};
+menu mnu_play_new_seeds = {0,0,dir_left,"New Random Seeds",&new_seeds,{NULL}};
 
 menu sub_end = {0,0,dir_none,NULL,NULL,{NULL}}; //set of NULLs to mark the end of a sub menu
 
@@ -184,9 +201,9 @@ menu Menu[]={
 	{0,1,dir_down,"File",NULL,{&mnu_file_open,&mnu_file_save,&mnu_file_saveas,&mnu_file_new,&mnu_file_quit,&sub_end}},
 	{0,0,dir_down,"Sequence",NULL,{&mnu_seq_setslew,&mnu_seq_setloop,&mnu_seq_setpitch,&mnu_seq_setdir,&mnu_seq_grid8x8,&mnu_seq_gridview,&mnu_seq_singlechnl,&mnu_seq_new,&sub_end}},
 //	{0,0,dir_down,"Sequence",NULL,{&mnu_seq_setslew,&mnu_seq_setloop,&mnu_seq_setpitch,&mnu_seq_setdir,&mnu_seq_quantise,&mnu_seq_gridview,&mnu_seq_singlechnl,&mnu_seq_new,&sub_end}},
-	{0,0,dir_down,"Conf",NULL,{&mnu_config_setzero,&mnu_config_set10v,&mnu_config_debug,&mnu_config_tune,&sub_end}},
+	{0,0,dir_down,"Conf",NULL,{&mnu_config_setzero,&mnu_config_set10v,&mnu_config_debug,&mnu_config_tune,&mnu_config_i2cstats,&sub_end}},
 	{0,0,dir_down,"Test",NULL,{&mnu_test_scalevalue,&mnu_config_setzero,&mnu_test_keyboard,&sub_end}},
-	{0,0,dir_down,"Play",NULL,{&mnu_play_step_one,&sub_end}},
+	{0,0,dir_down,"Play",NULL,{&mnu_play_step_one,&mnu_play_edits_step,&mnu_play_edits_bar,&mnu_play_store_pattern,&mnu_play_next_pattern,&mnu_play_prev_pattern,&mnu_play_chain_pattern,&mnu_play_new_seeds,&sub_end}},
 	{0,0,dir_down,NULL,NULL,{NULL}}
 	};
 
@@ -194,6 +211,7 @@ menu Menu[]={
 /* This is the main structure that holds info about the running sequence */
 struct europi Europi; 
 struct europi_hw Europi_hw;
+struct playstate Playstate;
 enum display_page_t DisplayPage = GridView;
 uint32_t ActiveOverlays;
 
@@ -269,6 +287,10 @@ while (!WindowShouldClose() && (prog_running ==1)) {
         break;
     }
  
+    // Act on anything that has come in on MIDI In
+    midi_dispatch();
+    // Catch up with a Pattern switch made by the clock
+    pattern_dispatch();
     usleep(100); 
 }
     ThreadEnd = TRUE;
@@ -278,6 +300,9 @@ while (!WindowShouldClose() && (prog_running ==1)) {
     for(i=0;i<4;i++) {
         if(midiThreadLaunched[i] == TRUE) pthread_join(midiThreadId[i], NULL);
     }
+    clock_stop();
+    sched_stop();
+    i2c_stop();
 	shutdown();
 	return 0;
   
@@ -28,7 +28,6 @@
 #include <pigpio.h>
 #include "slew_profiles.h"
 #include "quantizer_scales.h"
-#include "bjorklund.h"
 
 /* GPIO Port Assignments 		*/
 /* RPi Header pins in comments	*/
@@ -47,6 +46,7 @@
 #define RUNSTOP_IN	26	/* PIN 37	*/
 #define RESET_IN	16	/* PIN 36	*/
 //#define TOUCH_INT	17	/* PIN 11	*/
+//#define MIDI_IRQ_IN	21	/* PIN 40 - SC16IS750 IRQ from the MIDI Minions, if wired */
 
 /* SC16IS750 UART register definitions */
 #define SC16IS750_RHR	0x00 << 3
@@ -71,6 +71,33 @@
 #define SC16IS750_DLL	0x00 << 3	//Divisor Latch low
 #define SC16IS750_DLH	0x01 << 3	//Divisor Latch high
 
+/* MIDI Input. With no IRQ line, the RX FIFO is polled, backing off
+ * while nothing is arriving */
+#define MIDI_RX_BURST			32		/* Most bytes taken from the RX FIFO in one read (SMBus block limit) */
+#define MIDI_POLL_MIN			250		/* uS - a little under one byte time at 31250 baud */
+#define MIDI_POLL_ACTIVE_MAX	2000	/* uS - longest poll interval while MIDI is arriving */
+#define MIDI_POLL_IDLE_MAX		10000	/* uS - longest poll interval once MIDI In has gone quiet */
+#define MIDI_POLL_IDLE_AFTER	500000	/* uS of silence before MIDI In counts as quiet */
+#define MIDI_IRQ_TIMEOUT		50000	/* uS - longest wait for the IRQ line before checking anyway */
+#define MIDI_PORTS				4		/* One per MIDI Minion */
+#define MIDI_QUEUE_SIZE			256		/* Events per port - must be a power of 2 */
+#define MIDI_EVENT_DATA			8		/* Data bytes per event, ie the size of a SysEx chunk */
+#define MIDI_SYSEX_MAX			256		/* SysEx bytes passed on, any more are dropped */
+#define MIDI_SYSEX_START		0x01	/* First chunk of a SysEx message */
+#define MIDI_SYSEX_END			0x02	/* Last chunk of a SysEx message */
+#define MIDI_SYSEX_TRUNCATED	0x04	/* SysEx was longer than MIDI_SYSEX_MAX */
+
+/* MIDI Output. Messages for each MIDI Minion are staged, then written
+ * to its THR in as few block transfers as possible */
+#define MIDI_TX_BUF				32		/* Bytes that can be staged per MIDI Minion */
+#define MIDI_RUNNING_STATUS_TIMEOUT	250000	/* uS of silence after which the Status byte is always re-sent */
+#define MIDI_ANY_NOTE			0xFF	/* MIDINoteOff() - whatever is sounding on the channel */
+#define MIDI_CLOCK_TICKS		4		/* master_clock() ticks (96 per step) per MIDI Clock (24 per step) */
+#define MIDI_CLOCK_STOPPED		0		/* MIDI Clock Out states */
+#define MIDI_CLOCK_PENDING		1		/* Europi is running, waiting to send Start / Continue */
+#define MIDI_CLOCK_RUNNING		2
+#define MIDI_SONG_POSITION_MAX	0x3FFF	/* Song Position is 14 bits of MIDI Beats (16ths) */
+
 /* Hardware Address Constants */
 #define DAC_BASE_ADDR 	0x4C	/* Base i2c address	of DAC8574 */
 #define MCP_BASE_ADDR	0x20	/* Base i2c address of MCP23008 GPIO Expander */
@@ -92,6 +119,8 @@
 #define INT_CLK		0
 #define EXT_CLK		1
 #define MIDI_CLK    2
+#define CLOCK_BPM_MIN   100		/* Internal clock range, in hundredths of a BPM */
+#define CLOCK_BPM_MAX   99999
 #define TRUE		1
 #define FALSE		0
 #define UP          1
@@ -242,6 +271,187 @@ enum MidiType {
     SystemReset           = 0xFF,    ///< System Real Time - System Reset
 };
 
+/*
+ * MIDI_EVENT is one decoded message (or chunk of SysEx), as
+ * queued by the MIDI In parser
+ */
+struct midi_event {
+	uint32_t tick;			/* sched_tick() at which the message arrived */
+	uint8_t port;			/* MIDI Minion it arrived on */
+	uint8_t status;			/* Status byte, including the channel */
+	uint8_t len;			/* Number of bytes used in data */
+	uint8_t flags;			/* MIDI_SYSEX_START etc */
+	uint8_t data[MIDI_EVENT_DATA];
+};
+struct midi_queue {
+	struct midi_event events[MIDI_QUEUE_SIZE];
+	volatile uint32_t head;	/* Next slot to fill - Listener thread only */
+	volatile uint32_t tail;	/* Next slot to empty - main loop only */
+	uint32_t overflows;		/* Events dropped because the queue was full */
+};
+struct midi_tx {
+	uint8_t buf[MIDI_TX_BUF];	/* Bytes staged for the THR */
+	int count;
+	uint8_t running;		/* Status byte last sent, 0 if it needs sending again */
+	uint32_t last_sent;		/* sched_tick() of the last write */
+	uint8_t sounding[16];	/* Note sounding on each channel, + 1. 0 if none */
+	int notes;				/* Number of notes sounding, which lights the LED */
+	int led;				/* Current state of the activity LED */
+};
+struct midi_parser {
+	int port;
+	uint8_t status;			/* Running status, 0 if there isn't one */
+	int needed;				/* Data bytes the status needs */
+	int count;				/* Data bytes received so far */
+	uint8_t data[2];
+	int in_sysex;			/* TRUE between F0 and whatever ends it */
+	uint8_t sysex[MIDI_EVENT_DATA];	/* SysEx chunk being gathered */
+	int sysex_count;		/* Bytes in the chunk */
+	int sysex_total;		/* Bytes in the whole message so far */
+};
+
+/*
+ * SCHED_EVENT is a single timed entry in the Scheduler's queue.
+ * The handler is called once the deadline (a sched_tick() value)
+ * has passed. If the handler wants to be called again later on
+ * it updates the deadline and returns TRUE.
+ */
+#define SCHED_MAX_EVENTS ((MAX_TRACKS) * 8)	/* room for a Gate and a Ramp per track, with plenty of overlap */
+struct sched_event {
+	uint32_t deadline;		/* sched_tick() at which this event is due */
+	int (*handler)(struct sched_event *ev);	/* returns TRUE to be re-queued at the updated deadline */
+	void *arg;				/* Gate, Slew, AD or ADSR structure for the handler */
+	int phase;				/* where the handler has got to (Gate On/Off, Ramp segment etc) */
+	int count;				/* Ratchet counter within the phase */
+	uint32_t start;			/* sched_tick() at which the current Ramp segment started */
+};
+
+/*
+ * Gate, Slew, AD and ADSR descriptors handed to the Scheduler come
+ * from fixed pools rather than the heap. Each track owns a small ring
+ * of slots of each type, which is enough for the outputs of one step
+ * to overlap those still running on from the previous few steps.
+ */
+#define POOL_SLOTS_PER_TRACK 8
+
+/*
+ * I2C Bus worker. Writes are queued as I2C_REQs on one of the
+ * priority lanes below, and carried out in order by the Bus thread.
+ * Lower lane numbers are always served first. Requests on different
+ * lanes can overtake each other, so every write to any one device
+ * must go on the same lane
+ */
+#define I2C_LANE_GATE	0		/* Clock Out, Step 1, Gates and MIDI Notes */
+#define I2C_LANE_CV		1		/* Step CVs, Slew and Envelope points - everything sent to the DACs */
+#define I2C_LANES		2
+#define I2C_QUEUE_SIZE	256		/* Per lane - must be a power of 2 */
+#define I2C_MAX_REQ_BYTES 12	/* Enough for all four channels of a DAC8574 */
+#define I2C_OP_BYTE			0	/* i2cWriteByte */
+#define I2C_OP_BYTE_DATA	1	/* i2cWriteByteData */
+#define I2C_OP_WORD_DATA	2	/* i2cWriteWordData */
+#define I2C_OP_DEVICE		3	/* i2cWriteDevice */
+struct i2c_req {
+	int op;					/* One of the I2C_OP_ types */
+	unsigned handle;		/* pigpio handle of the device */
+	uint8_t reg;			/* Register, for the _DATA ops */
+	uint8_t len;			/* Number of bytes in data */
+	char data[I2C_MAX_REQ_BYTES];
+	uint32_t queued;		/* sched_tick() at which the request was queued */
+	void (*done)(const struct i2c_req *req, int ok);	/* Optional - called once the request has been written (or dropped) */
+};
+/*
+ * Output caches. Each DAC channel / GPIO extender port has a word
+ * recording the value the device is known to hold. It only becomes
+ * known (OUT_VALID) once the last write queued to it has completed,
+ * so a write still in the queue, or one that was dropped, can never
+ * cause a later write of the right value to be skipped
+ */
+#define OUT_VALUE_MASK		0x0000FFFF	/* Value last written */
+#define OUT_INFLIGHT		0x00010000	/* One write queued but not yet completed */
+#define OUT_INFLIGHT_MASK	0x0FFF0000
+#define OUT_VALID			0x80000000	/* The device holds OUT_VALUE */
+struct i2c_cell {
+	volatile uint32_t seq;	/* Sequence number, says whether the cell is free or published */
+	struct i2c_req req;
+};
+struct i2c_lane {
+	struct i2c_cell cells[I2C_QUEUE_SIZE];
+	volatile uint32_t enqueue_pos;	/* Next position to be claimed by a producer */
+	uint32_t dequeue_pos;			/* Next position to be taken by the Bus thread */
+	uint32_t depth_max;				/* Deepest the queue has been */
+	uint32_t count;					/* Number of requests carried out */
+	uint64_t latency_total;			/* uS from queueing to completion, summed */
+	uint32_t latency_max;			/* Worst queue to completion time, in uS */
+	uint32_t overflows;				/* Requests dropped because the lane was full */
+	uint64_t busy_us;				/* Time spent inside the HAL, summed */
+};
+
+/*
+ * Bus telemetry. Every transaction the Bus worker carries out (and
+ * every synchronous read) is counted against the device address it
+ * went to, along with an estimate of how long it kept the wire busy.
+ * Rates are worked out once a second by i2c_stats_sample()
+ */
+#define I2C_BUS_BIT_NS		2500	/* One SCL period at 400kHz */
+#define I2C_HIST_BUCKETS	10		/* Write latency: <16uS, <32uS ... <4096uS, >=4096uS */
+#define I2C_HIST_BASE_US	16
+#define I2C_STATS_PERIOD	1000000	/* uS between rate samples */
+
+/*
+ * Ramp rate governor. Every RAMP_GOVERN_PERIOD the Scheduler shares
+ * out whatever the bus has left over (after Gates, CVs, MIDI etc)
+ * between the Slews and Envelopes that are running, and sets
+ * slew_interval accordingly
+ */
+#define RAMP_GOVERN_PERIOD	20000	/* uS between governor updates */
+#define RAMP_BUDGET			800		/* Most of the bus ramps may have, per mille */
+#define RAMP_BUDGET_MIN		100		/* Least of the bus ramps will be squeezed to, per mille */
+#define SLEW_INTERVAL_MIN	250		/* Finest ramp resolution, uS between points */
+#define SLEW_INTERVAL_MAX	10000	/* Coarsest ramp resolution, uS between points */
+struct i2c_dev_stats {
+	uint32_t transactions;			/* Running totals */
+	uint32_t bytes;
+	uint64_t wire_ns;				/* Estimated time on the wire */
+	uint32_t last_transactions;		/* Totals at the last sample */
+	uint32_t last_bytes;
+	uint32_t tx_rate;				/* Transactions per second over the last sample */
+	uint32_t byte_rate;				/* Bytes per second over the last sample */
+};
+struct i2c_bus_stats {
+	struct i2c_dev_stats dev[128];	/* Indexed by 7-bit address */
+	uint32_t latency_hist[I2C_HIST_BUCKETS];	/* Queue to completion time of writes */
+	uint64_t busy_us;				/* Time spent inside the HAL, summed */
+	uint64_t wire_ns;				/* Estimated time on the wire, summed */
+	uint64_t last_busy_us;			/* Totals at the last sample */
+	uint64_t last_wire_ns;
+	uint32_t sample_tick;			/* sched_tick() of the last sample */
+	uint32_t busy_permille;			/* Share of the last sample the HAL was busy */
+	uint32_t wire_permille;			/* Share of the last sample the wire was busy */
+	uint32_t tx_rate;				/* Whole bus, per second */
+	uint32_t byte_rate;
+};
+
+/*
+ * Hardware Abstraction Layer. Every I2C access goes through one of
+ * these, which is either pigpio itself or the simulated bus
+ */
+struct hal_backend {
+	const char *name;
+	int (*open)(unsigned bus, unsigned addr, unsigned flags);
+	int (*close)(unsigned handle);
+	int (*write_byte)(unsigned handle, unsigned value);
+	int (*write_byte_data)(unsigned handle, unsigned reg, unsigned value);
+	int (*write_word_data)(unsigned handle, unsigned reg, unsigned value);
+	int (*write_device)(unsigned handle, char *buf, unsigned count);
+	int (*read_byte_data)(unsigned handle, unsigned reg);
+	int (*read_block_data)(unsigned handle, unsigned reg, char *buf, unsigned count);
+};
+extern struct hal_backend *hal;
+/* Rig modelled by the simulated backend when impersonate_hw is set */
+#define SIM_MINIONS			7
+#define SIM_MIDI_MINIONS	1
+#define SIM_MIDI_FIFO		"/tmp/europi_midi_in"	/* Bytes written here arrive on the first MIDI Minion's MIDI In */
+
 /* Function Prototypes in europi_func1 */
 int startup(void);
 int shutdown(void);
@@ -259,23 +469,125 @@ void button_3(int gpio, int level, uint32_t tick);
 void button_4(int gpio, int level, uint32_t tick); 
 void next_step(void);
 void set_step_one(void);
+void set_edits_on_step(void);
+void set_edits_on_bar(void);
+void store_pattern(void);
+void next_pattern(void);
+void prev_pattern(void);
+void chain_pattern(void);
+void new_seeds(void);
 int MidiMinonFinder(unsigned address);
 int MinonFinder(unsigned address);
 int EuropiFinder(void);
-void MIDISingleChannelWrite(unsigned handle, uint8_t channel, uint8_t velocity, uint16_t voltage);
 void DACSingleChannelWrite(int track, unsigned handle, uint8_t address, uint8_t channel, uint16_t voltage);
+void DACStage(int track, unsigned handle, uint8_t address, uint8_t channel, uint16_t voltage);
+void DACFlush(void);
+void GATEStage(unsigned handle, uint8_t channel,int Device,int Value);
+void GATEFlush(void);
+void OutputCacheInvalidate(void);
 void GATESingleOutput(unsigned handle, uint8_t channel,int Device,int Value);
 void hardware_init(void); 
 void reapply_config(void) ;
 int quantize(int raw, int scale);
 int pitch2midi(uint16_t voltage);
-void *SlewThread(void *arg); 
-void *GateThread(void *arg);
-void *AdThread(void *arg); 
-void *AdsrThread(void *arg); 
-void *MidiThread(void *arg); 
+int SlewEvent(struct sched_event *ev);
+int GateEvent(struct sched_event *ev);
+int AdEvent(struct sched_event *ev);
+int AdsrEvent(struct sched_event *ev);
 void *OvlTimerThread(void *arg);
 
+/* Function Prototypes in europi_clock.c */
+void *ClockThread(void *arg);
+void clock_start(void);
+void clock_stop(void);
+void tempo_edge(int source, uint32_t tick, int edges_per_step);
+uint32_t tempo_predict(void);
+
+/* Function Prototypes in europi_hal.c */
+void hal_init(void);
+
+/* Function Prototypes in europi_i2c.c */
+struct i2c_req;
+int i2c_write_byte(int lane, unsigned handle, uint8_t value, void (*done)(const struct i2c_req *, int));
+int i2c_write_byte_data(int lane, unsigned handle, uint8_t reg, uint8_t value, void (*done)(const struct i2c_req *, int));
+int i2c_write_word_data(int lane, unsigned handle, uint8_t reg, uint16_t value, void (*done)(const struct i2c_req *, int));
+int i2c_write_device(int lane, unsigned handle, char *buf, unsigned count, void (*done)(const struct i2c_req *, int));
+int i2c_read_byte_data(unsigned handle, uint8_t reg);
+int i2c_read_block_data(unsigned handle, uint8_t reg, char *buf, unsigned count);
+void *I2cThread(void *arg);
+void i2c_start(void);
+void i2c_stop(void);
+int i2c_open(unsigned bus, unsigned addr, unsigned flags);
+struct i2c_bus_stats *i2c_stats_sample(void);
+uint32_t i2c_ramp_interval(int active);
+int i2c_stats_dump(const char *path);
+
+/* Function Prototypes in europi_midi.c */
+void midi_parser_init(struct midi_parser *parser, int port);
+void midi_parse(struct midi_parser *parser, uint8_t byte, uint32_t tick);
+void midi_dispatch(void);
+void midi_interrupt(int gpio, int level, uint32_t tick);
+void *MidiThread(void *arg);
+void MIDINoteOn(unsigned handle, uint8_t channel, uint8_t note, uint8_t velocity);
+void MIDINoteOff(unsigned handle, uint8_t channel, uint8_t note);
+void MIDIAllNotesOff(void);
+void MIDIFlush(int lane);
+void MIDIClockOut(int running, int counter);
+
+/* Function Prototypes in europi_playhead.c */
+int playhead_advance(int track, int step_one);
+int playhead_position(int track);
+void playhead_apply(int track, int last_step, int direction, uint32_t seed);
+
+/* Function Prototypes in europi_seqfile.c */
+struct step;
+void step_pack(const struct step *pStep, uint8_t *rec);
+void step_unpack(const uint8_t *rec, struct step *pStep);
+int sequence_save(const char *filename);
+int sequence_load(const char *filename);
+
+/* Function Prototypes in europi_plan.c */
+struct plan_track;
+struct track;
+void plan_init(void);
+struct plan_track *plan_get(int track);
+struct plan_track *plan_swap(int track, int at_bar);
+void plan_publish(int track);
+void plan_publish_all(void);
+int plan_cue(const struct track *tracks[]);
+int plan_cue_take(void);
+int plan_cue_taken(void);
+void plan_cue_done(void);
+void plan_lock(void);
+void plan_unlock(void);
+
+/* Function Prototypes in europi_euclid.c */
+uint64_t euclid(int steps, int fill, int rotation);
+
+/* Function Prototypes in europi_song.c */
+void song_init(void);
+int pattern_store(int pattern);
+int pattern_copy(int from, int to);
+int pattern_queue(int pattern);
+int pattern_chain(int pattern, int chain);
+void pattern_dispatch(void);
+
+/* Function Prototypes in europi_sched.c */
+uint32_t sched_tick(void);
+int sched_add(uint32_t deadline, int (*handler)(struct sched_event *), void *arg);
+void *SchedulerThread(void *arg);
+void sched_start(void);
+void sched_stop(void);
+struct gate *gate_alloc(int track);
+void gate_free(struct gate *pGate);
+struct slew *slew_alloc(int track);
+void slew_free(struct slew *pSlew);
+struct ad *ad_alloc(int track);
+void ad_free(struct ad *pAD);
+struct adsr *adsr_alloc(int track);
+void adsr_free(struct adsr *pADSR);
+int sched_ramps_active(void);
+
 /* Function Prototypes in europi_func2 */ 
 void seq_singlechnl(void);
 void seq_gridview(void);
@@ -310,6 +622,7 @@ void config_setzero(void);
 void config_setten(void);
 void config_debug(void);
 void config_tune(void);
+void config_i2cstats(void);
 //void config_calibtouch(void);
 void set_zero(int Track, long ZeroVal);
 void file_quit(void);
@@ -321,7 +634,6 @@ void quantize_track(int track, int scale);
 uint16_t scale_value(int track,uint16_t raw_value);
 size_t file_list(const char *path, char ***ls);
 int cstring_cmp(const void *a, const void *b);
-int polyrhythm(uint32_t Steps, uint32_t Fill, uint32_t ThisStep);
 void hardware_config(void);
 
 
@@ -389,6 +701,7 @@ void gui_grid(void);
 #define MAX_TRACKS 2+(4*8)	/* 2 Tracks on Europi, plus 4 per minion, with total of 8 Minions */
 #define MAX_CHANNELS 2		/* 2 channels per track (CV + GATE) */
 #define MAX_STEPS 32		/* Up to 32 steps in an individual sequence */
+#define EUCLID_MAX_STEPS 64	/* Longest Euclidean rhythm - one bit each in a uint64_t */
 /* CHANNEL TYPE */
 #define CHNL_TYPE_CV 0
 #define CHNL_TYPE_GATE 1
@@ -410,6 +723,12 @@ enum chnl_function_t {
 #define DEV_RPI 2
 #define DEV_PCF8574 3
 #define DEV_SC16IS750 4
+#define I2C_MAX_HANDLES 64	/* pigpio limit on simultaneously open I2C handles */
+
+/* DAC8574 Load modes - bits [5:4] of the control byte */
+#define DAC8574_STORE	0x00	/* Write the channel's temporary register only */
+#define DAC8574_LOAD	0x10	/* Write and load the selected channel */
+#define DAC8574_LOADALL	0x20	/* Write the selected channel, then load all four together */
 
 /* Menu structures - Menus are defined using 
  * Arrays of structures containing the
@@ -499,7 +818,11 @@ struct gate {
 	int i2c_device;			/* Type of device (needed for Gate / Trigger outputs */
 	enum gate_type_t gate_type;   /* Off, Trigger, Gate */
 	int ratchets;	        /* How many times to re-trigger during the step */
-    int fill;               /* Euclidian fill value - if this is greater or equal to the ratchets, then every ratchet will sound */
+    uint64_t rhythm;        /* Which ratchets sound (bit 0 = first) - see euclid() */
+    uint32_t step_length;   /* Predicted length of the step, which the ratchets are spread across */
+    int epoch;              /* Playstate.gate_epoch the Gate was launched in, -1 = never cancelled */
+    uint8_t midi_note;      /* Note to play, if the 'Gate' is on a MIDI Minion */
+    uint8_t midi_velocity;
 };
 
 struct adsr {
@@ -554,6 +877,7 @@ struct ad_adsr_t {
 
 struct midiChnl {
     int i2c_handle;
+    int port;			/* Which of the MIDI Minions this is, 0 - 3 */
 };
 /* 
  * DEVICE records the physical configuration of 
@@ -579,21 +903,26 @@ struct device {
  * are unique to a particular track & channel. Steps contain
  * the output voltage, gate state etc for a Step.
  * 
+ * Steps are packed into bitfields (12 bytes, rather than 40) as
+ * there are over 2000 of them in a sequence. The enum fields are
+ * held as plain bitfields, but still take the enum values. On disk,
+ * each Step is a fixed 16 byte record - see europi_seqfile.c
  */
 struct step {
     // Applicable to steps within a CV Channel
-	int raw_value;			/* Non-scaled value to output on a 6000 step/Octave scale*/
+	uint16_t raw_value;		/* Non-scaled value to output on a 6000 step/Octave scale (0 - 60000) */
 	uint16_t scaled_value; 	/* Scaled / Quantised value to output */
-	enum slew_t slew_type;	/* Off, Linear, Logarithmic, Exponential, AD, ADSR */
-	enum slew_shape_t slew_shape;	/* Both, Rising, Falling*/
 	uint32_t slew_length; 	/* Slew length (in microseconds) */
+	unsigned slew_type:4;	/* enum slew_t: Off, Linear, Logarithmic, Exponential... */
+	unsigned slew_shape:2;	/* enum slew_shape_t: Both, Rising, Falling*/
 	// Applicable to steps within a GATE Channel
-    enum gate_type_t gate_type;
-	int ratchets;		    /* Number or ratchets to fit into this Step */
-    int fill;              /* Number of beats to fit within the number of Ratchets (Euclidian polyrhythm generator) */
-    int repetitions;        /* Number of times to repeat this step */
-    int repeat_counter;     /* Counter within the step itself to track step repeats */
+    unsigned gate_type:3;   /* enum gate_type_t */
+	unsigned ratchets:6;    /* Number or ratchets to fit into this Step (0 - 63) */
+    unsigned fill:6;        /* Number of beats to fit within the number of Ratchets (Euclidian polyrhythm generator) */
+    unsigned repetitions:4; /* Number of times to repeat this step (0 - 15) */
+    unsigned rotation:6;    /* Ratchets to rotate the Fill rhythm by */
 };
+#define STEP_RECORD_SIZE 16	/* Size of a packed Step in a sequence file */
 
 /* 
  * CHANNEL is an set of parameters for a single output,
@@ -622,14 +951,99 @@ struct channel {
  * a TRACK comprises two physical output channels linked 
  * together - a CV output plus its associated GATE output.
  */
+/*
+ * PLAYHEAD holds the precomputed play order of a track - see
+ * europi_playhead.c. Entry 0 is always Step 1 (which fires the
+ * Step 1 pulse)
+ */
+struct playhead_entry {
+	uint8_t step;			/* Step played at this point in the cycle */
+	uint8_t direction;		/* Direction the track is going at this point */
+};
+struct playhead;
+struct playmode {
+	int key;				/* Modes that share a cycle (eg Pendulum_F / _B) have the same key */
+	void (*build)(struct playhead *ph, int last_step);
+	int (*advance)(struct playhead *ph);	/* Returns the index of the next entry */
+};
+struct playhead {
+	struct playhead_entry cycle[MAX_STEPS * 2];
+	int length;				/* Entries in the cycle */
+	int index;				/* Where the track is in the cycle */
+	const struct playmode *mode;
+	int key_last_step;		/* last_step the cycle was built for */
+	int key_mode;			/* and the mode */
+	uint32_t rng;			/* Random mode's generator state - reseeded at Step 1 */
+};
 struct track{
 	struct channel channels[MAX_CHANNELS];	/* a TRACK contains an array of CHANNELs */
 	int selected;			    /* Track is selected for some sort of operation */
-	int track_busy;			    /* If TRUE then this Track won't advance to the next step */
-	int current_step;		    /* Tracks where this track is going next */
 	int last_step;			    /* sets the end step for a particular track */
     enum track_dir_t direction; /* Forwards, Backwards, Pendulum, Random */
     struct ad_adsr_t ad_adsr;   /* Holds per-track AD or ADSR shapes */
+    uint32_t seed;              /* Seeds the Random direction, so a take can be played again */
+};
+/*
+ * PLAYSTATE holds the per-track fields that next_step() reads and
+ * writes on every step, one packed array per field, so stepping all
+ * the tracks touches a handful of cache lines rather than a few bytes
+ * from each of the (large) track structures. struct track remains the
+ * editable, saved copy of last_step, direction and seed - changes to
+ * them reach Playstate through the track's output plan, so call
+ * plan_publish() after changing any of them.
+ */
+struct playstate {
+	uint8_t current_step[MAX_TRACKS];	/* Tracks where this track is going next */
+	uint8_t last_step[MAX_TRACKS];		/* track.last_step, from the live plan */
+	uint8_t direction[MAX_TRACKS];		/* track.direction, from the live plan (but updated by Pendulum) */
+	uint8_t track_busy[MAX_TRACKS];		/* If TRUE then this Track won't advance to the next step */
+	uint8_t repeat_counter[MAX_TRACKS];	/* Repeats played so far of the current step */
+	uint8_t gate_epoch[MAX_TRACKS];		/* Bumped once a step's Gate event is queued, so older ones know to stop */
+	uint32_t seed[MAX_TRACKS];			/* track.seed, from the live plan */
+};
+/*
+ * OUTPUT PLAN is what next_step() does for each Track / Step, worked
+ * out in advance from the channel type, function and step settings,
+ * so the clock only has to replay it. Edits reach playback by
+ * publishing a new plan - see europi_plan.c
+ */
+#define PLAN_SWAP_STEP	0		/* Published edits are played from the track's next step */
+#define PLAN_SWAP_BAR	1		/* ... or from the next time Track 0 passes Step 1 */
+enum plan_cv_t {
+	PLAN_CV_NONE,			/* CV Channel disabled */
+	PLAN_CV_SET,			/* Static voltage - straight DAC write */
+	PLAN_CV_SLEW,			/* Slew from the previous step */
+	PLAN_CV_AD,
+	PLAN_CV_ADSR,
+	PLAN_CV_MIDI			/* Note on a MIDI Minion, played by a Gate event */
+};
+struct plan_step {
+	uint8_t cv_action;		/* enum plan_cv_t */
+	uint8_t gate;			/* TRUE if the Gate channel fires */
+	uint8_t gate_type;		/* Gate pattern for the Gate (or MIDI note) */
+	uint8_t ratchets;
+	uint8_t midi_note;
+	uint8_t slew_type;
+	uint8_t slew_shape;
+	uint8_t repetitions;	/* Times the step is played before moving on */
+	uint16_t value;			/* DAC code (scaled_value) for this step */
+	uint32_t slew_length;
+	uint64_t rhythm;		/* euclid() of the step's ratchets, fill and rotation */
+};
+struct plan_track {
+	struct plan_step steps[MAX_STEPS];
+	/* Per-track parts of the events, with the device already filled in */
+	struct slew slew;
+	struct ad ad;
+	struct adsr adsr;
+	struct gate midi;
+	struct gate gate;
+	int cv_handle;
+	int cv_address;
+	int cv_channel;
+	uint8_t last_step;		/* Applied to Playstate when the plan is swapped in */
+	uint8_t direction;
+	uint32_t seed;
 };
 /*
  * Europi is the main Container structure for the Hardware
@@ -670,18 +1084,30 @@ struct hw_track{
 struct europi_hw{
     struct hw_track hw_tracks[MAX_TRACKS];
 };
+/*
+ * TRACK_BLOCK is one Track's worth of a stored Pattern. Blocks are
+ * never changed once stored, and are shared between Patterns, so
+ * copying a Pattern - or re-storing one where only a few Tracks
+ * have been edited - only costs the Tracks that actually differ
+ */
+struct track_block {
+	int refs;				/* Patterns (and the working copy) using this block */
+	struct track track;
+};
 /* 
  * PATTERN is one main loopable section, 
  * can contain many TRACKS 
  */
 struct pattern {
 	int sequence_index;
-	struct track tracks[MAX_TRACKS];
+	int chain;				/* Pattern to queue once this one starts, -1 = just keep repeating */
+	struct track_block *tracks[MAX_TRACKS];	/* All NULL until the Pattern has been stored */
 };
 /* SEQUENCE contains many Patterns chained together */
 struct sequence {
 	int sequence_index;
-	int next_pattern;							/* used to control the way sequences are chained together in a Song */
+	int current_pattern;						/* Pattern being played / edited in Europi */
+	int next_pattern;							/* Pattern queued to start at the next bar, -1 = none */
 	struct pattern patterns[MAX_SEQUENCES];	/* Array of Sequences */
 };
 
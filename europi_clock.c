@@ -0,0 +1,226 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Internal Clock Engine
+ *
+ * Generates the 96 PPQN tick stream that drives master_clock().
+ * This used to come from an alert function registered against a
+ * hardware PWM output, which meant the tempo could only be set to
+ * whole numbers of Hz. Instead, the Clock thread sleeps to absolute
+ * deadlines on the Monotonic clock, and works out each deadline
+ * from an integer phase accumulator so the BPM can be set to 0.01
+ * of a beat with no drift, however long the prog runs for.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "europi.h"
+
+extern int ThreadEnd;
+extern int clock_source;
+
+int clock_bpm = 24000;				/* Internal clock tempo in hundredths of a BPM */
+pthread_t clockThreadId;			/* The Internal Clock thread */
+int clockThreadLaunched = FALSE;
+
+/*
+ * Tick length in nS at a given tempo is 60s / (BPM * 96). With BPM
+ * held in hundredths this is 60e9 * 100 / (bpm_x100 * 96), which
+ * simplifies to CLOCK_NS_PER_BPM / bpm_x100
+ */
+#define CLOCK_NS_PER_BPM 62500000000ULL
+#define CLOCK_NS_PER_SEC 1000000000ULL
+
+/*
+ * Tempo tracker state. Clock edges from an external source are run
+ * through an alpha-beta filter, which tracks both the phase of the
+ * edges and the period between them. The filtered period is much
+ * steadier than the raw last interval, and follows a tempo ramp
+ * without lagging a whole step behind it.
+ */
+#define TEMPO_ALPHA	0.3			/* Phase correction gain */
+#define TEMPO_BETA	0.05		/* Period correction gain */
+static int tempo_source = -1;			/* Clock source that fed the last edge */
+static int tempo_edges_per_step = 1;
+static int tempo_edges = 0;				/* Number of edges seen since the last reset */
+static uint32_t tempo_last;				/* Tick of the last edge */
+static uint32_t tempo_est;				/* Filtered tick of the last edge */
+static double tempo_period;				/* Filtered uS between edges */
+static volatile uint32_t tempo_step_us = 0;	/* Predicted length of the next step, 0 = don't know */
+
+/* Current time on the Monotonic clock in nS */
+static uint64_t clock_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * CLOCK_NS_PER_SEC) + ts.tv_nsec;
+}
+
+/*
+ * Clock Thread - Joinable thread that lives for the whole
+ * time the prog is running.
+ * The phase accumulator holds the next deadline as a whole
+ * number of nS plus a remainder in units of 1/bpm_x100 nS,
+ * so each tick advances by exactly CLOCK_NS_PER_BPM / bpm_x100
+ * with nothing lost to rounding. A tempo change takes effect
+ * from the next tick, keeping the phase of the current one.
+ */
+void *ClockThread(void *arg)
+{
+	struct timespec ts;
+	uint64_t next_ns;
+	uint64_t period_ns = 0;
+	uint64_t period_rem = 0;
+	uint64_t phase_rem = 0;
+	int bpm = 0;
+	next_ns = clock_now();
+	while(!ThreadEnd){
+		if(clock_bpm != bpm){
+			bpm = clock_bpm;
+			if(bpm < CLOCK_BPM_MIN) bpm = CLOCK_BPM_MIN;
+			if(bpm > CLOCK_BPM_MAX) bpm = CLOCK_BPM_MAX;
+			period_ns = CLOCK_NS_PER_BPM / bpm;
+			period_rem = CLOCK_NS_PER_BPM % bpm;
+			phase_rem = 0;
+		}
+		next_ns += period_ns;
+		phase_rem += period_rem;
+		if(phase_rem >= (uint64_t)bpm){
+			phase_rem -= bpm;
+			next_ns++;
+		}
+		ts.tv_sec = next_ns / CLOCK_NS_PER_SEC;
+		ts.tv_nsec = next_ns % CLOCK_NS_PER_SEC;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		/* If we've been held up for more than a whole step (debugger,
+		 * system suspend etc) don't try to catch up by firing a burst
+		 * of ticks, just pick up from now */
+		if((clock_now() - next_ns) > (period_ns * 96)) next_ns = clock_now();
+		master_clock(MASTER_CLK, 0, sched_tick());
+	}
+	return NULL;
+}
+
+/*
+ * CLOCK_START
+ * Launches the Internal Clock thread. Called once from startup()
+ */
+void clock_start(void)
+{
+	struct sched_param param;
+	if(pthread_create(&clockThreadId, NULL, ClockThread, NULL) != 0){
+		log_msg("Error creating Clock thread\n");
+		return;
+	}
+	clockThreadLaunched = TRUE;
+	// The Clock needs to run ahead of everything else, including the Scheduler
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 5;
+	if(pthread_setschedparam(clockThreadId, SCHED_FIFO, &param) != 0){
+		log_msg("Clock running without RT priority\n");
+	}
+}
+
+/*
+ * CLOCK_STOP
+ * Waits for the Clock thread to notice ThreadEnd
+ */
+void clock_stop(void)
+{
+	if(clockThreadLaunched == TRUE){
+		pthread_join(clockThreadId, NULL);
+		clockThreadLaunched = FALSE;
+	}
+}
+
+/*
+ * TEMPO_EDGE
+ * Feeds a clock edge into the tempo tracker. tick is the uS time of
+ * the edge (any time base will do, so long as a source always uses
+ * the same one) and edges_per_step is the number of edges the source
+ * sends per step, ie 1 for the External Clock input and
+ * midi_clock_divisor for MIDI Clock. The tracker re-locks from
+ * scratch if the source changes or the interval jumps by more than
+ * a factor of two, for instance when an external clock is stopped
+ * and re-started at a different tempo.
+ */
+void tempo_edge(int source, uint32_t tick, int edges_per_step)
+{
+	int32_t interval;
+	double residual;
+	if((source != tempo_source) || (edges_per_step != tempo_edges_per_step)){
+		tempo_source = source;
+		tempo_edges_per_step = edges_per_step;
+		tempo_edges = 0;
+	}
+	interval = (int32_t)(tick - tempo_last);
+	// Bytes read in the same MIDI In burst share a tick - that says
+	// nothing about the tempo, so leave the tracker as it was
+	if((tempo_edges != 0) && (interval <= 0)) return;
+	tempo_last = tick;
+	if(tempo_edges == 0){
+		tempo_edges++;
+		tempo_est = tick;
+		return;
+	}
+	if((tempo_edges == 1) || (interval > (2 * tempo_period)) || (interval < (tempo_period / 2))){
+		// (Re)acquire lock using the raw interval
+		tempo_edges = 2;
+		tempo_period = interval;
+		tempo_est = tick;
+	}
+	else {
+		tempo_edges++;
+		residual = (double)(int32_t)(tick - tempo_est) - tempo_period;
+		tempo_est += (uint32_t)(int32_t)(tempo_period + (TEMPO_ALPHA * residual));
+		tempo_period += TEMPO_BETA * residual;
+	}
+	if(tempo_period > 0) tempo_step_us = (uint32_t)(tempo_period * tempo_edges_per_step);
+}
+
+/*
+ * TEMPO_PREDICT
+ * Returns the expected length, in uS, of the step that is just
+ * starting. On the internal clock this is known exactly from the
+ * BPM, otherwise it comes from the tempo tracker. Returns 0 if
+ * the tracker hasn't locked on to anything yet.
+ */
+uint32_t tempo_predict(void)
+{
+	int bpm;
+	if(clock_source == INT_CLK){
+		bpm = clock_bpm;
+		if(bpm < CLOCK_BPM_MIN) bpm = CLOCK_BPM_MIN;
+		if(bpm > CLOCK_BPM_MAX) bpm = CLOCK_BPM_MAX;
+		// 60s in uS * 100 / bpm_x100
+		return (uint32_t)(6000000000ULL / bpm);
+	}
+	return tempo_step_us;
+}
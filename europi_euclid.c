@@ -0,0 +1,162 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Euclidean rhythms
+ *
+ * Spreads a number of beats (fill) as evenly as possible across a
+ * number of ratchets, using E. Bjorklund's algorithm from 'The
+ * Theory of Rep-Rate Pattern Generation in the SNS Timing Systems'.
+ * The result is surprisingly musical, and generates rhythms that
+ * are recognisable from various cultures.
+ *
+ * Patterns are returned as a bitset - bit 0 is the first ratchet -
+ * so any length up to EUCLID_MAX_STEPS can be generated, and rotated
+ * to start from a different beat. They used to come from a table of
+ * 2 - 32 step patterns (bjorklund.h); generating them takes O(steps),
+ * and the last few asked for are kept in a small LRU cache, so the
+ * GUI can redraw them every frame for nothing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "europi.h"
+
+#define EUCLID_CACHE_SIZE 16
+
+struct euclid_entry {
+	uint32_t key;			/* steps, fill and rotation - 0 = unused */
+	uint32_t used;			/* When this entry was last used */
+	uint64_t pattern;
+};
+static struct euclid_entry euclid_cache[EUCLID_CACHE_SIZE];
+static uint32_t euclid_clock;
+static pthread_mutex_t euclid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct bjorklund {
+	int counts[EUCLID_MAX_STEPS];
+	int remainders[EUCLID_MAX_STEPS];
+	uint64_t pattern;
+	int length;
+};
+
+/* Mask covering the first steps bits */
+static uint64_t euclid_mask(int steps)
+{
+	return (steps >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << steps) - 1);
+}
+
+/*
+ * Lays out the pattern from the counts and remainders worked out
+ * by bjorklund_generate(). Level -1 is a rest, -2 a beat
+ */
+static void bjorklund_build(struct bjorklund *pBj, int level)
+{
+	int i;
+	if(level == -1){
+		pBj->length++;
+	}
+	else if(level == -2){
+		pBj->pattern |= (uint64_t)1 << pBj->length;
+		pBj->length++;
+	}
+	else {
+		for(i = 0; i < pBj->counts[level]; i++) bjorklund_build(pBj, level - 1);
+		if(pBj->remainders[level] != 0) bjorklund_build(pBj, level - 2);
+	}
+}
+
+/*
+ * Generates the pattern for fill beats in steps, rotated so that
+ * it starts on a beat
+ */
+static uint64_t bjorklund_generate(int steps, int fill)
+{
+	struct bjorklund bj;
+	int divisor = steps - fill;
+	int level = 0;
+	int first;
+	if(fill <= 0) return 0;
+	if(fill >= steps) return euclid_mask(steps);
+	memset(&bj, 0, sizeof(bj));
+	bj.remainders[0] = fill;
+	do {
+		bj.counts[level] = divisor / bj.remainders[level];
+		bj.remainders[level + 1] = divisor % bj.remainders[level];
+		divisor = bj.remainders[level];
+		level++;
+	} while(bj.remainders[level] > 1);
+	bj.counts[level] = divisor;
+	bjorklund_build(&bj, level);
+	first = __builtin_ctzll(bj.pattern);
+	if(first == 0) return bj.pattern;
+	return ((bj.pattern >> first) | (bj.pattern << (steps - first))) & euclid_mask(steps);
+}
+
+/*
+ * EUCLID
+ * Returns the rhythm for fill beats spread across steps ratchets,
+ * rotated rotation steps later, as a bitset (bit 0 = first step).
+ * A single step always sounds, as does anything over
+ * EUCLID_MAX_STEPS
+ */
+uint64_t euclid(int steps, int fill, int rotation)
+{
+	struct euclid_entry *pEntry;
+	uint64_t pattern;
+	uint32_t key;
+	int i;
+	if((steps < 2) || (steps > EUCLID_MAX_STEPS)) return ~(uint64_t)0;
+	if(fill < 0) fill = 0;
+	if(fill > steps) fill = steps;
+	rotation %= steps;
+	if(rotation < 0) rotation += steps;
+	key = ((uint32_t)steps << 16) | ((uint32_t)fill << 8) | (uint32_t)rotation;
+
+	pthread_mutex_lock(&euclid_lock);
+	pEntry = &euclid_cache[0];
+	for(i = 0; i < EUCLID_CACHE_SIZE; i++){
+		if(euclid_cache[i].key == key){
+			euclid_cache[i].used = ++euclid_clock;
+			pattern = euclid_cache[i].pattern;
+			pthread_mutex_unlock(&euclid_lock);
+			return pattern;
+		}
+		// Otherwise replace the least recently used entry
+		if(euclid_cache[i].used < pEntry->used) pEntry = &euclid_cache[i];
+	}
+	pattern = bjorklund_generate(steps, fill);
+	if(rotation != 0){
+		pattern = ((pattern << rotation) | (pattern >> (steps - rotation))) & euclid_mask(steps);
+	}
+	pEntry->key = key;
+	pEntry->used = ++euclid_clock;
+	pEntry->pattern = pattern;
+	pthread_mutex_unlock(&euclid_lock);
+	return pattern;
+}
@@ -74,7 +74,6 @@ extern int extclk_counter;
 extern int extclk_level;
 extern int clock_counter;
 extern int clock_level;
-extern int clock_freq;
 extern int clock_source;
 extern int TuningOn;
 extern uint16_t TuningVoltage; 
@@ -120,6 +119,8 @@ extern int btnB_state;
 extern int btnC_state;
 extern int btnD_state;
 extern struct europi Europi;
+extern struct playstate Playstate;
+extern struct sequence Song;
 extern struct europi_hw Europi_hw;
 extern enum display_page_t DisplayPage;
 //extern struct screen_overlays ScreenOverlays;
@@ -131,7 +132,19 @@ extern pthread_mutex_t mcp23008_lock;
 extern pthread_mutex_t pcf8574_lock;
 extern pthread_t midiThreadId[]; 
 extern int midiThreadLaunched[];
-extern uint8_t mcp23008_state[16];
+extern uint8_t mcp23008_state[I2C_MAX_HANDLES];
+extern uint8_t mcp23008_dirty[I2C_MAX_HANDLES];
+extern int pcf8574_dirty;
+extern unsigned pcf8574_handle;
+extern pthread_mutex_t dac8574_lock;
+extern uint16_t dac8574_value[I2C_MAX_HANDLES][4];
+extern uint8_t dac8574_dirty[I2C_MAX_HANDLES];
+extern uint8_t dac8574_address[I2C_MAX_HANDLES];
+extern int midi_irq;
+extern int plan_swap_mode;
+extern uint32_t dac8574_out[I2C_MAX_HANDLES][4];
+extern uint32_t mcp23008_out[I2C_MAX_HANDLES];
+extern uint32_t pcf8574_out;
 extern int test_v;
 pthread_t ThreadId; 		// Pointer to detatched Thread Ids (re-used by each/every detatched thread)
 extern SpriteFont font1;
@@ -164,14 +177,19 @@ extern int first_file;
  * from program start to end.
  * 
  * The Master Clock runs at 96 * The BPM step
- * frequency
+ * frequency, and is called from the Clock
+ * thread in europi_clock.c
  */
 void master_clock(int gpio, int level, uint32_t tick)
 {
-	if ((run_stop == RUN) && (clock_source == INT_CLK)) {
-		if (clock_counter++ > 95) {
-			clock_counter = 0;
-			GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,HIGH);
+	int running = (run_stop == RUN) && (clock_source == INT_CLK);
+	if (running && (++clock_counter > 95)) clock_counter = 0;
+	// MIDI Clock goes out first, so it doesn't wait on next_step()
+	MIDIClockOut(running, clock_counter);
+	if (running) {
+		if (clock_counter == 0) {
+			// Staged, so Clock Out goes high along with anything next_step() changes
+			GATEStage(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,HIGH);
 			next_step();
 		}
 		if (clock_counter == 48) GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,LOW);
@@ -184,6 +202,8 @@ void master_clock(int gpio, int level, uint32_t tick)
  */
 void external_clock(int gpio, int level, uint32_t tick)
 {
+	// Keep the tempo tracker locked even while stopped, so the first step has a sensible length
+	if ((clock_source == EXT_CLK) && (level == 1)) tempo_edge(EXT_CLK, tick, 1);
 	if ((run_stop == RUN) && (clock_source == EXT_CLK)) {
 		// Copy the external clock to the Clock Out port
 		GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,level);
@@ -219,657 +239,589 @@ void set_step_one(void)
 {
 	step_one = TRUE;	
 }
+/*
+ * Menu callbacks choosing when edits are heard - from
+ * each track's next step, or from the next bar
+ */
+void set_edits_on_step(void)
+{
+	plan_swap_mode = PLAN_SWAP_STEP;
+}
+void set_edits_on_bar(void)
+{
+	plan_swap_mode = PLAN_SWAP_BAR;
+}
+/*
+ * Menu callbacks for the Pattern bank. Next / Prev queue the
+ * neighbouring Pattern to start at the next bar - one that has
+ * never been stored starts as a copy of the current Pattern.
+ * Chain toggles whether the current Pattern is followed by the
+ * next one, so a run of Patterns plays as a Song
+ */
+void store_pattern(void)
+{
+	pattern_store(Song.current_pattern);
+}
+void next_pattern(void)
+{
+	if(Song.current_pattern < MAX_SEQUENCES - 1) pattern_queue(Song.current_pattern + 1);
+}
+void prev_pattern(void)
+{
+	if(Song.current_pattern > 0) pattern_queue(Song.current_pattern - 1);
+}
+void chain_pattern(void)
+{
+	int pattern = Song.current_pattern;
+	if(Song.patterns[pattern].chain >= 0) pattern_chain(pattern, -1);
+	else if(pattern < MAX_SEQUENCES - 1) pattern_chain(pattern, pattern + 1);
+}
+/*
+ * Gives every track a new seed for the Random direction. The
+ * tracks carry on with their current take until they next go
+ * back to Step 1
+ */
+void new_seeds(void)
+{
+	int track;
+	for(track = 0; track < (MAX_TRACKS); track++){
+		Europi.tracks[track].seed = (uint32_t)rand();
+		plan_publish(track);
+	}
+}
+/*
+ * STEP_ONE_PULSE
+ * Fires a Trigger on the Europi's Step 1 output. Track 0 Channel 1
+ * will have the GPIO Handle for the PCF8574, channel 3 is Step 1 Out
+ */
+static void step_one_pulse(uint32_t tick)
+{
+	struct gate sGate;
+	sGate.track = 0;
+	sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
+	sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
+	sGate.i2c_channel = STEP1_OUT;
+	sGate.i2c_device = DEV_PCF8574;
+	sGate.gate_type = Trigger;
+	sGate.ratchets = 1;
+	sGate.rhythm = 1;
+	sGate.step_length = step_ticks;
+	// Nothing else drives the Step 1 output, so it always finishes its pulse
+	sGate.epoch = -1;
+	struct gate *pGate = gate_alloc(0);
+	if(pGate != NULL){
+		memcpy(pGate, &sGate, sizeof(struct gate));
+		if(sched_add(tick, &GateEvent, pGate) < 0){
+			gate_free(pGate);
+		}
+	}
+}
+
 /* Function called to advance the sequence on to the next step */
 void next_step(void)
 {
-	uint32_t current_tick = gpioTick();
-	// first ever time it's run, there will be
-	// no value for step_tick, to the length of
-	// the first step will be indeterminate. So,
-	// set it to 200ms.
-	if (step_tick == 0) step_ticks = 250000; else step_ticks = current_tick - step_tick;
+	uint32_t current_tick = sched_tick();
+	// Gates, Ratchets etc are timed against the predicted
+	// length of this step. If the tempo tracker hasn't locked
+	// on yet, fall back to the length of the previous step. The
+	// first ever time it's run, there will be no value for
+	// step_tick, so the length of the first step will be
+	// indeterminate. So, set it to 250ms.
+	step_ticks = tempo_predict();
+	if (step_ticks == 0) {
+		if (step_tick == 0) step_ticks = 250000; else step_ticks = current_tick - step_tick;
+	}
 	//log_msg("Step Ticks: %d\n",step_ticks);
 	step_tick = current_tick;
 	int previous_step, channel, track;
+	struct plan_track *pPlan;
+	struct plan_step *pNow;
+	int bar = step_one;
+	int restart = step_one;
+	uint8_t epoch;
 	/* look for something to do */
 	//for (track = 0;track < MAX_TRACKS; track++){
 	for (track = 0;track < last_track; track++){
 		/* if this track is busy doing something else, then it won't advance to the next step */
-		if (Europi.tracks[track].track_busy == FALSE){
+		if (Playstate.track_busy[track] == FALSE){
 			/* Each Track has its own end point */
-			previous_step = Europi.tracks[track].current_step;
-            /* Switch behaviour depending on the direction this track moves in */
-            switch (Europi.tracks[track].direction){
-                case Forwards:
-                default:
-                    if(++Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter >= Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repetitions || step_one == TRUE){
-                       Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter = 0;
-                       if (++Europi.tracks[track].current_step >= Europi.tracks[track].last_step || step_one == TRUE){
-                            Europi.tracks[track].current_step = 0;
-                            /* IF we've got Europi hardware, trigger the Step 1 pulse as Track 0 passes through Step 0 */
-                            if ((is_europi == TRUE) && (track == 0)){
-                                /* Track 0 Channel 1 will have the GPIO Handle for the PCF8574 channel 3 is Step 1 Out*/
-								//log_msg("Step One\n");
-                                struct gate sGate;
-                                sGate.track = track;
-                                sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
-                                sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
-                                sGate.i2c_channel = STEP1_OUT;
-                                sGate.i2c_device = DEV_PCF8574;
-                                sGate.gate_type = Trigger;
-                                sGate.ratchets = 1;
-                                sGate.fill = 1;
-                                struct gate *pGate = malloc(sizeof(struct gate));
-                                memcpy(pGate, &sGate, sizeof(struct gate));
-                                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                                    log_msg("Gate thread creation error\n");
-                                }
-                            }
-                        }
-                    }                
-                    break;
-                case Backwards:
-                    if(++Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter >= Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repetitions || step_one == TRUE){
-                       Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter = 0;
-                        if(Europi.tracks[track].current_step == 0 && step_one == FALSE){
-                            Europi.tracks[track].current_step = Europi.tracks[track].last_step -1;
-                        }
-                        else if (Europi.tracks[track].current_step == 1 || step_one == TRUE){
-                            Europi.tracks[track].current_step = 0;
-                            /* IF we've got Europi hardware, trigger the Step 1 pulse as Track 0 passes through Step 0 */
-                            if ((is_europi == TRUE) && (track == 0)){
-                                /* Track 0 Channel 1 will have the GPIO Handle for the PCF8574 channel 3 is Step 1 Out*/
-                                struct gate sGate;
-                                sGate.track = track;
-                                sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
-                                sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
-                                sGate.i2c_channel = STEP1_OUT;
-                                sGate.i2c_device = DEV_PCF8574;
-                                sGate.gate_type = Trigger;
-                                sGate.ratchets = 1;
-                                sGate.fill = 1;
-                                struct gate *pGate = malloc(sizeof(struct gate));
-                                memcpy(pGate, &sGate, sizeof(struct gate));
-                                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                                    log_msg("Gate thread creation error\n");
-                                }
-                            }
+			previous_step = Playstate.current_step[track];
+            /* Once the step has had all its repeats, move on to the next
+             * step in this track's play order */
+            pPlan = plan_get(track);
+            if((++Playstate.repeat_counter[track] >= pPlan->steps[previous_step].repetitions) || (restart == TRUE)){
+                Playstate.repeat_counter[track] = 0;
+                if((playhead_advance(track, restart) == TRUE) && (track == 0)){
+                    /* Track 0 passing through Step 0 marks the bar. IF we've
+                     * got Europi hardware, trigger the Step 1 pulse */
+                    bar = TRUE;
+                    if(is_europi == TRUE) step_one_pulse(current_tick);
+                    /* If a Pattern is queued, every track switches to it
+                     * now, and the rest of the tracks restart at Step 1 */
+                    if(plan_cue_take() == TRUE) restart = TRUE;
+                }
+            }
+            /* Pick up any edits published since the last step (or bar) */
+            pPlan = plan_swap(track, bar);
+            /* Once this step's Gate event has been queued, anything still
+             * running from the last step on this track's Gate stops,
+             * rather than cutting across this one */
+            epoch = Playstate.gate_epoch[track] + 1;
+			/* Play this step's output plan. In General, anything that
+             * isn't a simple static voltage is handed to the scheduler
+             * as an event, as this removes the processing load from
+             * the main program loop
+             */
+            pNow = &pPlan->steps[Playstate.current_step[track]];
+            switch(pNow->cv_action){
+                case PLAN_CV_SET:
+                    // No Slew - just set the output CV
+                    log_msg("SingleChannelWrite, Trk: %d Chnl: %d, Val: %d\n",track,CV_OUT,pNow->value);
+                    DACStage(track, pPlan->cv_handle, pPlan->cv_address, pPlan->cv_channel, pNow->value);
+                break;
+                case PLAN_CV_SLEW:
+                    {
+                    log_msg("slew\n");
+                    struct slew *pSlew = slew_alloc(track);
+                    if(pSlew != NULL){
+                        memcpy(pSlew, &pPlan->slew, sizeof(struct slew));
+                        pSlew->start_value = pPlan->steps[previous_step].value;
+                        pSlew->end_value = pNow->value;
+                        pSlew->slew_length = pNow->slew_length;
+                        pSlew->slew_type = pNow->slew_type;
+                        pSlew->slew_shape = pNow->slew_shape;
+                        if(sched_add(current_tick, &SlewEvent, pSlew) < 0){
+                            slew_free(pSlew);
                         }
-                        else Europi.tracks[track].current_step--;
+                    }
                     }
                 break;
-                case Pendulum_F:
-                    /* Advances forwards until it reaches the last step */
-                    if(++Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter >= Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repetitions || step_one == TRUE){
-                       Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter = 0;
-                        if (++Europi.tracks[track].current_step >= Europi.tracks[track].last_step && step_one == FALSE){
-                            Europi.tracks[track].current_step--;
-                            Europi.tracks[track].direction = Pendulum_B;
-                        }
-                        else if (step_one == TRUE) {
-                            Europi.tracks[track].current_step = 0;
-                            /* IF we've got Europi hardware, trigger the Step 1 pulse as Track 0 passes through Step 0 */
-                            if ((is_europi == TRUE) && (track == 0)){
-                                /* Track 0 Channel 1 will have the GPIO Handle for the PCF8574 channel 3 is Step 1 Out*/
-                                struct gate sGate;
-                                sGate.track = track;
-                                sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
-                                sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
-                                sGate.i2c_channel = STEP1_OUT;
-                                sGate.i2c_device = DEV_PCF8574;
-                                sGate.gate_type = Trigger;
-                                sGate.ratchets = 1;
-                                sGate.fill = 1;
-                                struct gate *pGate = malloc(sizeof(struct gate));
-                                memcpy(pGate, &sGate, sizeof(struct gate));
-                                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                                    log_msg("Gate thread creation error\n");
-                                }
-                            }
+                case PLAN_CV_AD:
+                    {
+                    struct ad *pAD = ad_alloc(track);
+                    if(pAD != NULL){
+                        memcpy(pAD, &pPlan->ad, sizeof(struct ad));
+                        pAD->a_end_value = pNow->value;
+                        if(sched_add(current_tick, &AdEvent, pAD) < 0){
+                            ad_free(pAD);
                         }
                     }
+                    }
                 break;
-                case Pendulum_B:
-                    if(++Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter >= Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repetitions || step_one == TRUE){
-                       Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter = 0;
-                        if(Europi.tracks[track].current_step == 0 || step_one == TRUE){
-                            Europi.tracks[track].direction = Pendulum_F;
-                            Europi.tracks[track].current_step = 0;
-                            /* IF we've got Europi hardware, trigger the Step 1 pulse as Track 0 passes through Step 0 */
-                            if ((is_europi == TRUE) && (track == 0)){
-                                /* Track 0 Channel 1 will have the GPIO Handle for the PCF8574 channel 3 is Step 1 Out*/
-                                struct gate sGate;
-                                sGate.track = track;
-                                sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
-                                sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
-                                sGate.i2c_channel = STEP1_OUT;
-                                sGate.i2c_device = DEV_PCF8574;
-                                sGate.gate_type = Trigger;
-                                sGate.ratchets = 1;
-                                sGate.fill = 1;
-                                struct gate *pGate = malloc(sizeof(struct gate));
-                                memcpy(pGate, &sGate, sizeof(struct gate));
-                                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                                    log_msg("Gate thread creation error\n");
-                                }
-                            }
+                case PLAN_CV_ADSR:
+                    {
+                    struct adsr *pADSR = adsr_alloc(track);
+                    if(pADSR != NULL){
+                        memcpy(pADSR, &pPlan->adsr, sizeof(struct adsr));
+                        pADSR->a_end_value = pNow->value;
+                        if(sched_add(current_tick, &AdsrEvent, pADSR) < 0){
+                            adsr_free(pADSR);
                         }
-                        else Europi.tracks[track].current_step--;
+                    }
                     }
                 break;
-                case Random:
-                    if(++Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter >= Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repetitions || step_one == TRUE){
-                       Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].repeat_counter = 0;
-                        Europi.tracks[track].current_step = rand() % Europi.tracks[track].last_step;
-                        if(Europi.tracks[track].current_step == 0 || step_one == TRUE){
-                            Europi.tracks[track].current_step = 0;
-                            if ((is_europi == TRUE) && (track == 0)){
-                                /* Track 0 Channel 1 will have the GPIO Handle for the PCF8574 channel 3 is Step 1 Out*/
-                                struct gate sGate;
-                                sGate.track = track;
-                                sGate.i2c_handle = Europi.tracks[0].channels[GATE_OUT].i2c_handle;
-                                sGate.i2c_address = Europi.tracks[0].channels[GATE_OUT].i2c_address;
-                                sGate.i2c_channel = STEP1_OUT;
-                                sGate.i2c_device = DEV_PCF8574;
-                                sGate.gate_type = Trigger;
-                                sGate.ratchets = 1;
-                                sGate.fill = 1;
-                                struct gate *pGate = malloc(sizeof(struct gate));
-                                memcpy(pGate, &sGate, sizeof(struct gate));
-                                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                                    log_msg("Gate thread creation error\n");
-                                }
-                            }
+                case PLAN_CV_MIDI:
+                    /* MIDI Minions have no Gate output, so the note is played
+                     * by a Gate event instead, which times the Note Off from
+                     * the step's Gate length, and does any ratchets */
+                    {
+                    struct gate *pGate = gate_alloc(track);
+                    if(pGate != NULL){
+                        memcpy(pGate, &pPlan->midi, sizeof(struct gate));
+                        pGate->gate_type = pNow->gate_type;
+                        pGate->ratchets = pNow->ratchets;
+                        pGate->rhythm = pNow->rhythm;
+                        pGate->step_length = step_ticks;
+                        pGate->epoch = epoch;
+                        pGate->midi_note = pNow->midi_note;
+                        if(sched_add(current_tick, &GateEvent, pGate) < 0){
+                            gate_free(pGate);
                         }
+                        else __atomic_store_n(&Playstate.gate_epoch[track], epoch, __ATOMIC_RELEASE);
+                    }
                     }
                 break;
-			}
-			/* Deal with the various different types of Analogue output
-             * In General, this launches a thread to deal with anything
-             * that isn't a simple static voltage, as this removes the
-             * processing load from the main program loop
-             */
-            if(Europi.tracks[track].channels[CV_OUT].enabled == TRUE) {
-				//log_msg("CV Out, Trk: %d Chnl: %d, Val: %d\n",track,CV_OUT,Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value);
-                switch(Europi.tracks[track].channels[CV_OUT].type){
-                    default:
-                    case CHNL_TYPE_CV:
-                        // CV Channels can have a function of CV, AD or ADSR
-                        switch(Europi.tracks[track].channels[CV_OUT].function){
-                            default:
-                            case CV:
-                                if(Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type == Off){
-                                    // No Slew - just set the output CV
-									log_msg("SingleChannelWrite, Trk: %d Chnl: %d, Val: %d\n",track,CV_OUT,Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value);
-                                    DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value);
-                                }
-                                else {
-                                    // Slew
-									log_msg("slew\n");
-                                    struct slew sSlew;
-                                    sSlew.track = track;
-                                    sSlew.i2c_handle = Europi.tracks[track].channels[CV_OUT].i2c_handle;
-                                    sSlew.i2c_address = Europi.tracks[track].channels[CV_OUT].i2c_address;
-                                    sSlew.i2c_channel = Europi.tracks[track].channels[CV_OUT].i2c_channel;
-                                    sSlew.start_value = Europi.tracks[track].channels[CV_OUT].steps[previous_step].scaled_value;
-                                    sSlew.end_value = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value;
-                                    sSlew.slew_length = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_length;
-                                    sSlew.slew_type = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type;
-                                    sSlew.slew_shape = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_shape;
-                                    struct slew *pSlew = malloc(sizeof(struct slew));
-                                    memcpy(pSlew, &sSlew, sizeof(struct slew));
-                                    if(pthread_create(&ThreadId, &detached_attr, &SlewThread, pSlew)){
-                                        log_msg("Slew thread creation error\n");
-                                    }
-                                }
-                            
-                            break;
-                            case AD:
-                                {
-                                    // Always starts and end on Zero
-                                    struct ad sAD;
-                                    sAD.track = track;
-                                    sAD.i2c_handle = Europi.tracks[track].channels[CV_OUT].i2c_handle;
-                                    sAD.i2c_address = Europi.tracks[track].channels[CV_OUT].i2c_address;
-                                    sAD.i2c_channel = Europi.tracks[track].channels[CV_OUT].i2c_channel;
-                                    sAD.a_start_value = Europi.tracks[track].channels[CV_OUT].scale_zero;	
-                                    sAD.a_end_value = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value;	
-                                    sAD.a_length = Europi.tracks[track].ad_adsr.a_length;		
-                                    sAD.a_start_value = Europi.tracks[track].channels[CV_OUT].scale_zero;	
-                                    sAD.d_length = Europi.tracks[track].ad_adsr.d_length;
-                                    sAD.shot_type = Repeat;
-                                    struct ad *pAD = malloc(sizeof(struct ad));
-                                    memcpy(pAD, &sAD, sizeof(struct ad));
-                                    if(pthread_create(&ThreadId, &detached_attr, &AdThread, pAD)){
-                                    log_msg("Attack-Decay thread creation error\n");
-                                    }
-                                }
-                            
-                            break;
-                            case ADSR:
-                                {
-                                    // Starts and ends on Zero. sustain level is a % of the max level
-                                    struct adsr sADSR;
-                                    sADSR.track = track;
-                                    sADSR.i2c_handle = Europi.tracks[track].channels[CV_OUT].i2c_handle;
-                                    sADSR.i2c_address = Europi.tracks[track].channels[CV_OUT].i2c_address;
-                                    sADSR.i2c_channel = Europi.tracks[track].channels[CV_OUT].i2c_channel;
-                                    sADSR.a_start_value = Europi.tracks[track].channels[CV_OUT].scale_zero;	
-                                    sADSR.a_end_value = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value;
-                                    sADSR.a_length = Europi.tracks[track].ad_adsr.a_length;	
-                                    sADSR.d_length = Europi.tracks[track].ad_adsr.d_length;
-                                    sADSR.s_level = Europi.tracks[track].ad_adsr.s_level;  
-                                    sADSR.s_length = Europi.tracks[track].ad_adsr.s_length;
-                                    sADSR.r_end_value = Europi.tracks[track].channels[CV_OUT].scale_zero;	
-                                    sADSR.r_length = Europi.tracks[track].ad_adsr.r_length;
-                                    struct adsr *pADSR = malloc(sizeof(struct adsr));
-                                    memcpy(pADSR, &sADSR, sizeof(struct adsr));
-                                    if(pthread_create(&ThreadId, &detached_attr, &AdsrThread, pADSR)){
-                                    log_msg("ADSR thread creation error\n");
-                                    }
-                                }
-                            break;
-                        }
-                    break;
-                    case CHNL_TYPE_MIDI:
-                        MIDISingleChannelWrite(Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_channel, 0x40, Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value);   
-                    break;
-                }
-                               
+                default:
+                case PLAN_CV_NONE:
+                break;
             }
             
-			/* launch a thread to handle the gate function for each channel / step */
-			if (Europi.tracks[track].channels[GATE_OUT].enabled == TRUE ){
-                struct gate sGate;
-                sGate.track = track;
-                sGate.i2c_handle = Europi.tracks[track].channels[GATE_OUT].i2c_handle;
-                sGate.i2c_address = Europi.tracks[track].channels[GATE_OUT].i2c_address;
-                sGate.i2c_channel =  Europi.tracks[track].channels[GATE_OUT].i2c_channel;
-                sGate.i2c_device = Europi.tracks[track].channels[GATE_OUT].i2c_device;
-                sGate.ratchets = Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].ratchets;
-                sGate.gate_type = Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].gate_type;
-                sGate.fill = Europi.tracks[track].channels[GATE_OUT].steps[Europi.tracks[track].current_step].fill;
-                struct gate *pGate = malloc(sizeof(struct gate));
-                memcpy(pGate, &sGate, sizeof(struct gate));
-                if(pthread_create(&ThreadId, &detached_attr, &GateThread, pGate)){
-                    log_msg("Gate thread creation error\n");
+			/* launch a gate event for each channel / step */
+			if (pNow->gate == TRUE){
+                struct gate *pGate = gate_alloc(track);
+                if(pGate != NULL){
+                    memcpy(pGate, &pPlan->gate, sizeof(struct gate));
+                    pGate->gate_type = pNow->gate_type;
+                    pGate->ratchets = pNow->ratchets;
+                    pGate->rhythm = pNow->rhythm;
+                    pGate->step_length = step_ticks;
+                    pGate->epoch = epoch;
+                    if(sched_add(current_tick, &GateEvent, pGate) < 0){
+                        gate_free(pGate);
+                    }
+                    else __atomic_store_n(&Playstate.gate_epoch[track], epoch, __ATOMIC_RELEASE);
                 }
 			}
 		}
 	}
 	/* anything that needed resetting back to step 1 will have done so */
 	if (step_one == TRUE) step_one = FALSE;
+	/* Write out any CV and Gate changes staged during this step - CVs
+	 * first, so they have settled by the time the Gates open */
+	DACFlush();
+	GATEFlush();
+	MIDIFlush(I2C_LANE_GATE);
+}
+
+/*
+ * RAMP_POINT
+ * Works out which point of a ramp segment is due now, from the
+ * time elapsed since the segment started (ev->start) rather than
+ * from how many points have been output so far. If we've fallen
+ * behind, the points we've missed are simply skipped, so a segment
+ * always takes exactly length uS however slow the I2C bus is.
+ * Returns TRUE with *point set and ev->deadline set to the absolute
+ * time the next point is due, or FALSE once the segment has
+ * finished, in which case ev->start moves on to the (ideal) end
+ * of the segment, ready for the next one.
+ */
+static int ramp_point(struct sched_event *ev, uint32_t length, uint32_t *point, uint32_t *num_steps)
+{
+	uint32_t elapsed = sched_tick() - ev->start;
+	*num_steps = length / slew_interval;
+	if((*num_steps == 0) && (length > 0)) *num_steps = 1;
+	if(elapsed >= length){
+		ev->start += length;
+		return FALSE;
+	}
+	*point = (uint32_t)(((uint64_t)elapsed * *num_steps) / length);
+	ev->deadline = ev->start + (uint32_t)(((uint64_t)(*point + 1) * length) / *num_steps);
+	return TRUE;
 }
 
 /*
- * ADSR thread.
+ * RAMP_SEGMENT
+ * Outputs whichever point of one linear segment of an AD or ADSR
+ * ramp is due now. Returns TRUE if the event needs re-queueing for
+ * the next point, or FALSE once the segment is complete, in which
+ * case the caller moves on to the next segment straight away
+ */
+static int ramp_segment(struct sched_event *ev, int track, unsigned handle, uint8_t address, uint8_t channel, int from, int to, uint32_t length, int lo, int hi)
+{
+	uint32_t point;
+	uint32_t num_steps;
+	int this_value;
+	if(!ramp_point(ev, length, &point, &num_steps)) return FALSE;
+	this_value = from + (int)(((int64_t)(to - from) * point) / num_steps);
+	// Rail clamp
+	if(this_value > hi) this_value = hi;
+	if(this_value < lo) this_value = lo;
+	DACStage(track, handle, address, channel, this_value);
+	return TRUE;
+}
+
+/*
+ * ADSR Event.
  * ADSR Profile ramp generator. Always starts and ends at Zero, and
- * the sustain level is expressed as a Percentage of the max Attack value
+ * the sustain level is expressed as a Percentage of the max Attack value.
+ * ev->phase steps through the Attack, Decay, Sustain and Release segments,
+ * each of which starts at the ideal end time of the one before
  */
-void *AdsrThread(void *arg)
+int AdsrEvent(struct sched_event *ev)
 {
-	struct adsr *pADSR = (struct adsr *)arg;
-	uint16_t this_value;
-	uint32_t start_tick = gpioTick();
-    uint16_t sus_level;
-	int step_size;
-	int num_steps;
-	int i;
-    // Set Track Busy flag
-    Europi.tracks[pADSR->track].track_busy = TRUE;
-    sus_level = ((pADSR->a_end_value - pADSR->a_start_value) * pADSR->s_level)/100;
-    // A-ramp
-    this_value = pADSR->a_start_value;
-    DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-    if(pADSR->a_length >= slew_interval){
-        step_size = (pADSR->a_end_value - pADSR->a_start_value) / (pADSR->a_length / slew_interval);
-        num_steps = (pADSR->a_end_value - pADSR->a_start_value) / step_size;
-        if (step_size == 0) {step_size = 1; num_steps = (pADSR->a_end_value - pADSR->a_start_value);}
-        for(i = 0;i < num_steps; i++){
-            usleep(slew_interval / 2);
-            // Rail clamp
-            if((this_value += step_size) <= Europi.tracks[pADSR->track].channels[CV_OUT].scale_max){
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-            }
-            else {
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, Europi.tracks[pADSR->track].channels[CV_OUT].scale_max);
-            }
-        }
-    }
-    // D-ramp
-    this_value = pADSR->a_end_value;
-    DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-    if(pADSR->d_length >= slew_interval){
-        step_size = (pADSR->a_end_value - sus_level) / (pADSR->d_length / slew_interval);
-        num_steps = (pADSR->a_end_value - sus_level) / step_size;
-        if (step_size == 0) {step_size = 1; num_steps = (pADSR->a_end_value - sus_level);}
-        for(i = 0;i < num_steps; i++){
-            usleep(slew_interval / 2);
-            // Rail clamp
-            if((this_value -= step_size) >= Europi.tracks[pADSR->track].channels[CV_OUT].scale_zero){
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-            }
-            else {
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, Europi.tracks[pADSR->track].channels[CV_OUT].scale_zero);
-            }
-        }
-    }
-    // Sustain time
-    usleep(pADSR->s_length);
-    
-    // Release ramp
-    this_value = sus_level;
-    DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-    if(pADSR->r_length >= slew_interval){
-        step_size = (sus_level - pADSR->r_end_value) / (pADSR->r_length / slew_interval);
-        num_steps = (sus_level - pADSR->r_end_value) / step_size;
-        if (step_size == 0) {step_size = 1; num_steps = (sus_level - pADSR->r_end_value);}
-        for(i = 0;i < num_steps; i++){
-            usleep(slew_interval / 2);
-            // Rail clamp
-            if((this_value -= step_size) >= Europi.tracks[pADSR->track].channels[CV_OUT].scale_zero){
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, this_value);
-            }
-            else {
-                DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, Europi.tracks[pADSR->track].channels[CV_OUT].scale_zero);
-            }
-        }
-    }
-    
-    DACSingleChannelWrite(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, pADSR->r_end_value);
-    // Clear Track Busy flag
-    Europi.tracks[pADSR->track].track_busy = FALSE;
-	free(pADSR);
-	return(0);
+	struct adsr *pADSR = (struct adsr *)ev->arg;
+	int scale_zero = Europi.tracks[pADSR->track].channels[CV_OUT].scale_zero;
+	int scale_max = Europi.tracks[pADSR->track].channels[CV_OUT].scale_max;
+	int sus_level = ((pADSR->a_end_value - pADSR->a_start_value) * pADSR->s_level)/100;
+	while(1){
+		switch(ev->phase){
+			case 0:
+				// A-ramp
+				Playstate.track_busy[pADSR->track] = TRUE;
+				if(ramp_segment(ev, pADSR->track, pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, pADSR->a_start_value, pADSR->a_end_value, pADSR->a_length, 0, scale_max)) return TRUE;
+				ev->phase++;
+			break;
+			case 1:
+				// D-ramp
+				if(ramp_segment(ev, pADSR->track, pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, pADSR->a_end_value, sus_level, pADSR->d_length, scale_zero, 65535)) return TRUE;
+				ev->phase++;
+			break;
+			case 2:
+				// Sustain time
+				if((sched_tick() - ev->start) < pADSR->s_length){
+					ev->deadline = ev->start + pADSR->s_length;
+					return TRUE;
+				}
+				ev->start += pADSR->s_length;
+				ev->phase++;
+			break;
+			case 3:
+				// Release ramp
+				if(ramp_segment(ev, pADSR->track, pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, sus_level, pADSR->r_end_value, pADSR->r_length, scale_zero, 65535)) return TRUE;
+				ev->phase++;
+			break;
+			default:
+				DACStage(pADSR->track,pADSR->i2c_handle, pADSR->i2c_address, pADSR->i2c_channel, pADSR->r_end_value);
+				// Clear Track Busy flag
+				Playstate.track_busy[pADSR->track] = FALSE;
+				adsr_free(pADSR);
+				return FALSE;
+		}
+	}
 }
 
 
 /*
- * Attack-Decay thread.
+ * Attack-Decay Event.
  * Simple AD ramp, which can be set to OneShot or Repeat
  */
-void *AdThread(void *arg)
+int AdEvent(struct sched_event *ev)
 {
-	struct ad *pAD = (struct ad *)arg;
-	uint16_t this_value;
-	uint32_t start_tick = gpioTick();
-	int step_size;
-	int num_steps;
-	int i;
+	struct ad *pAD = (struct ad *)ev->arg;
 	// don't bother if it's anything other than a 'normal' AD profile
-	if((pAD->a_end_value > pAD->a_start_value) && (pAD->d_end_value < pAD->a_end_value)){
-		// Set Track Busy flag
-		Europi.tracks[pAD->track].track_busy = TRUE;
-		// A-ramp
-		this_value = pAD->a_start_value;
-		DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, this_value);
-		if(pAD->a_length >= slew_interval){
-			step_size = (pAD->a_end_value - pAD->a_start_value) / (pAD->a_length / slew_interval);
-			num_steps = (pAD->a_end_value - pAD->a_start_value) / step_size;
-			if (step_size == 0) {step_size = 1; num_steps = (pAD->a_end_value - pAD->a_start_value);}
-			for(i = 0;i < num_steps; i++){
-				usleep(slew_interval / 2);
-				// Rail clamp
-				if((this_value += step_size) <= 60000){
-					DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, this_value);
-				}
-				else {
-					DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, 60000);
-				}
-			}
-		}
-		// D-ramp
-		this_value = pAD->a_end_value;
-		DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, this_value);
-		if(pAD->d_length >= slew_interval){
-			step_size = (pAD->a_end_value - pAD->d_end_value) / (pAD->d_length / slew_interval);
-			num_steps = (pAD->a_end_value - pAD->d_end_value) / step_size;
-			if (step_size == 0) {step_size = 1; num_steps = (pAD->a_end_value - pAD->d_end_value);}
-			for(i = 0;i < num_steps; i++){
-				usleep(slew_interval / 2);
-				// Rail clamp
-				if((this_value -= step_size) >= 0){
-					DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, this_value);
-				}
-				else {
-					DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, 0);
-				}
-			}
+	if(!((pAD->a_end_value > pAD->a_start_value) && (pAD->d_end_value < pAD->a_end_value))){
+		ad_free(pAD);
+		return FALSE;
+	}
+	while(1){
+		switch(ev->phase){
+			case 0:
+				// A-ramp
+				Playstate.track_busy[pAD->track] = TRUE;
+				if(ramp_segment(ev, pAD->track, pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, pAD->a_start_value, pAD->a_end_value, pAD->a_length, 0, 60000)) return TRUE;
+				ev->phase++;
+			break;
+			case 1:
+				// D-ramp
+				if(ramp_segment(ev, pAD->track, pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, pAD->a_end_value, pAD->d_end_value, pAD->d_length, 0, 65535)) return TRUE;
+				ev->phase++;
+			break;
+			default:
+				DACStage(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, pAD->d_end_value);
+				// Clear Track Busy flag
+				Playstate.track_busy[pAD->track] = FALSE;
+				ad_free(pAD);
+				return FALSE;
 		}
-		DACSingleChannelWrite(pAD->track,pAD->i2c_handle, pAD->i2c_address, pAD->i2c_channel, pAD->d_end_value);
-		// Clear Track Busy flag
-		Europi.tracks[pAD->track].track_busy = FALSE;
-	}	
-	free(pAD);
-	return(0);
+	}
 }
 
 /*
- * Slew Thread - launched for each Track / Step that
- * has a slew value other than SLEW_OFF. This thread
- * function lives just to perform the slew, then
- * ends itself. It executes the slew by stepping through
- * a pre-calculated array for each slew shape (Linear, Exponential etc)
+ * Slew Event - queued for each Track / Step that
+ * has a slew value other than SLEW_OFF. It executes
+ * the slew by stepping through a pre-calculated array
+ * for each slew shape (Linear, Exponential etc), one
+ * point per call, re-queueing itself until it reaches
+ * the end value. Points are timed from the start of
+ * the slew, so it lasts exactly slew_length.
  */
-void *SlewThread(void *arg)
+int SlewEvent(struct sched_event *ev)
 {
-	struct slew *pSlew = (struct slew *)arg;
-	uint16_t this_value = pSlew->start_value;
-	uint32_t start_tick = gpioTick();
-	int step_size;
-    int num_steps;
-    float profile_offset;
-    float profile_index;
-    float pitch_jump;
-    int slew_profile;
+	struct slew *pSlew = (struct slew *)ev->arg;
+	uint16_t this_value;
+	uint32_t point;
+	uint32_t num_steps;
+	float pitch_jump;
+	int slew_profile;
 
 	if (pSlew->slew_length == 0) {
-		// No slew length set, so just output this step and close the thread
-		DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
-		free(pSlew);
-		return(0);
+		// No slew length set, so just output this step and finish
+		DACStage(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
+		slew_free(pSlew);
+		return FALSE;
 	}
-	
 	if ((pSlew->end_value > pSlew->start_value) && ((pSlew->slew_shape == Rising) || (pSlew->slew_shape == Both))) {
 		// Glide UP
-        switch(pSlew->slew_type){
-            case Exponential:
-                slew_profile = 1;
-                break;
-            case RevExp:
-                slew_profile = 2;
-                break;
-            case Linear:
-            default:
-                slew_profile = 0;
-                break;
-        }
-        num_steps = pSlew->slew_length / slew_interval;
-        profile_index = (float)100 / (float)num_steps;
-		pitch_jump = pSlew->end_value - pSlew->start_value;
-        profile_offset = 0;
-        while((num_steps > 0) && (this_value <= pSlew->end_value)){
-            this_value = pSlew->start_value + ((slew_profiles[0][slew_profile][(int)profile_offset] / (float)100) * pitch_jump);
-            DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, this_value);
-			usleep(slew_interval / 2);		
-            profile_offset += profile_index;
-            num_steps--;
-        }
-        DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
+		switch(pSlew->slew_type){
+			case Exponential:
+				slew_profile = 1;
+				break;
+			case RevExp:
+				slew_profile = 2;
+				break;
+			case Linear:
+			default:
+				slew_profile = 0;
+				break;
+		}
+		if(ramp_point(ev, pSlew->slew_length, &point, &num_steps)){
+			pitch_jump = pSlew->end_value - pSlew->start_value;
+			this_value = pSlew->start_value + ((slew_profiles[0][slew_profile][(point * 100) / num_steps] / (float)100) * pitch_jump);
+			DACStage(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, this_value);
+			return TRUE;
+		}
 	}
 	else if ((pSlew->end_value < pSlew->start_value) && ((pSlew->slew_shape == Falling) || (pSlew->slew_shape == Both))){
 		// Glide Down
-        switch(pSlew->slew_type){
-            case Exponential:
-                slew_profile = 4;
-                break;
-            case RevExp:
-                slew_profile = 5;
-                break;
-            case Linear:
-            default:
-                slew_profile = 3;
-                break;
-        }
-        num_steps = pSlew->slew_length / slew_interval;
-        profile_index = (float)100 / (float)num_steps;
-		pitch_jump = pSlew->start_value - pSlew->end_value;
-        profile_offset = 0;
-        while((num_steps > 0) && (this_value >= pSlew->end_value)){
-            this_value = pSlew->end_value + ((slew_profiles[1][slew_profile][(int)profile_offset] / (float)100) * pitch_jump);
-            DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, this_value);
-			usleep(slew_interval / 2);		
-            profile_offset += profile_index;
-            num_steps--;
-        }
-        DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
+		switch(pSlew->slew_type){
+			case Exponential:
+				slew_profile = 4;
+				break;
+			case RevExp:
+				slew_profile = 5;
+				break;
+			case Linear:
+			default:
+				slew_profile = 3;
+				break;
+		}
+		if(ramp_point(ev, pSlew->slew_length, &point, &num_steps)){
+			pitch_jump = pSlew->start_value - pSlew->end_value;
+			this_value = pSlew->end_value + ((slew_profiles[1][slew_profile][(point * 100) / num_steps] / (float)100) * pitch_jump);
+			DACStage(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, this_value);
+			return TRUE;
+		}
 	}
-	else {
-		// Slew set, but Rising or Falling are off, so just output the end value
-		DACSingleChannelWrite(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
+	// Slew finished (or Rising / Falling are off), so just output the end value
+	DACStage(pSlew->track,pSlew->i2c_handle, pSlew->i2c_address, pSlew->i2c_channel, pSlew->end_value);
+	slew_free(pSlew);
+	return FALSE;
+}
+
+/*
+ * GATE_STAGE
+ * Turns a Gate on or off. On a MIDI Minion, the 'Gate' is a
+ * note, so a Gate Off step turns off whatever is sounding, and
+ * otherwise it's just the step's own note that is turned off
+ */
+static void gate_stage(struct gate *pGate, int value)
+{
+	if(pGate->i2c_device == DEV_SC16IS750){
+		if(value) MIDINoteOn(pGate->i2c_handle, pGate->i2c_channel, pGate->midi_note, pGate->midi_velocity);
+		else MIDINoteOff(pGate->i2c_handle, pGate->i2c_channel, (pGate->gate_type == Gate_Off) ? MIDI_ANY_NOTE : pGate->midi_note);
+		return;
 	}
-    free(pSlew);
-	return(0);
+	GATEStage(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,value);
+}
+
+/*
+ * RATCHET_EDGE
+ * Tick at which the passed edge (On edges are even, Off edges odd)
+ * of a ratchetting Gate falls, for a step that started at start
+ */
+static uint32_t ratchet_edge(uint32_t start, const struct gate *pGate, int edge)
+{
+	return start + (uint32_t)(((uint64_t)pGate->step_length * edge) / (2 * pGate->ratchets));
 }
 
 /*
- * Gate Thread - launched for each Track / Step that
- * has a Gate/Trigger. For normal Gsates, it uses gate_type 
+ * Gate Event - queued for each Track / Step that
+ * has a Gate/Trigger. For normal Gates, it uses gate_type 
  * to determine the length of the pulse. 
  * If a ratchet value is set, then it will output a series of
  * pulses timed to fit within the known length of the Step. It
  * uses a Fill value to determine how many of these ratchets actually
- * sound. If Fill >= ratchets, then all will sound, otherwise it
- * looks up the fill sequence in a pre-calculated Euclidian fill
- * table, which gives quite musical rhythmic fills up to 32 ratchets 
- * per step. Above this, it just outputs 100% ratchets.
+ * sound. If Fill >= ratchets, then all will sound, otherwise they
+ * follow a Euclidean rhythm, which gives quite musical rhythmic
+ * fills. The rhythm is worked out when the output plan is built, so
+ * all this has to do is test the ratchet's bit.
  * 
- * The thread lives just to perform the gate, then ends itself
+ * Gate lengths are timed from the deadline of the previous edge, and
+ * each ratchet edge from the start of the step (ev->start), so
+ * neither drifts with however late the scheduler woke up. Once the
+ * track's next step has queued its own Gate event, any edges still
+ * to come are dropped - the new event owns the output. If nothing
+ * newer was queued (eg the Gate has been turned off), the old event
+ * runs to the end, so the Gate is never left high.
+ * Edges are only staged here - the Scheduler flushes them out once it
+ * has run every event that is due.
+ * ev->phase is 1 while the Gate is On, ev->count is the ratchet number
  */
-void *GateThread(void *arg)
+int GateEvent(struct sched_event *ev)
 {
-	struct gate *pGate = (struct gate *)arg;
+	struct gate *pGate = (struct gate *)ev->arg;
+	uint32_t gate_length;
+	uint64_t to_come;
     // If global tuning is on, ignore all Gate info, just turn all the gates ON and quit
     if(TuningOn == TRUE){
-        GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1); 
-        free(pGate);
-        return(0);
+        gate_stage(pGate,1); 
+        gate_free(pGate);
+        return FALSE;
+    }
+    // Left over from the track's last step (eg the tempo has gone up). The
+    // new step's event may run before its epoch is published, so only a
+    // newer epoch than this one counts
+    if((pGate->epoch >= 0) && ((int8_t)(__atomic_load_n(&Playstate.gate_epoch[pGate->track], __ATOMIC_ACQUIRE) - (uint8_t)pGate->epoch) > 0)){
+        // A different MIDI note would be left hanging
+        if((ev->phase == 1) && (pGate->i2c_device == DEV_SC16IS750)) gate_stage(pGate,0);
+        gate_free(pGate);
+        return FALSE;
     }
 	//log_msg("Gate H: %d, Ch: %d, Dev: %d\n",pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device);
     if (pGate->ratchets <= 1){
         //Normal Gate
+        if(ev->phase == 1){
+            /* Gate Off */
+            gate_stage(pGate,0);
+            gate_free(pGate);
+            return FALSE;
+        }
         switch(pGate->gate_type){
             case Gate_Off:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
-            break;
+                gate_stage(pGate,0);
+                gate_free(pGate);
+                return FALSE;
             case Gate_On:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-            break;
+                gate_stage(pGate,1);
+                gate_free(pGate);
+                return FALSE;
             case Trigger:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep(10000);  //10ms Pulse
-                /* Gate Off */
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
+                gate_length = 10000;  //10ms Pulse
             break;
             case Gate_25:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep((step_ticks * 25)/100);
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
+                gate_length = (pGate->step_length * 25)/100;
             break;
             case Gate_50:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep((step_ticks * 50)/100);
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
+                gate_length = (pGate->step_length * 50)/100;
             break;
             case Gate_75:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep((step_ticks * 75)/100);
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
+                gate_length = (pGate->step_length * 75)/100;
             break;
             case Gate_95:
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep((step_ticks * 95)/100);
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
+                gate_length = (pGate->step_length * 95)/100;
             break;
+            default:
+                gate_free(pGate);
+                return FALSE;
         }
+        gate_stage(pGate,1);
+        ev->phase = 1;
+        ev->deadline += gate_length;
+        return TRUE;
     }
     // Ratchetting Gate
+    /* The step is split into one slot per ratchet, and a ratchet that
+     * sounds is On for the first half of its slot. Edge n is at n/2
+     * slots from the start of the step, so even the last Off edge
+     * lands inside the predicted step length */
+    if(ev->phase == 1){
+        /* Gate Off */
+        gate_stage(pGate,0);
+        ev->phase = 0;
+        ev->count++;
+    }
+    else if((ev->count < EUCLID_MAX_STEPS) && (pGate->rhythm & ((uint64_t)1 << ev->count))){
+        /* Ratchet is ON - Gate On */
+        gate_stage(pGate,1);
+        ev->phase = 1;
+        ev->deadline = ratchet_edge(ev->start, pGate, (2 * ev->count) + 1);
+        return TRUE;
+    }
     else {
-        /* this step is to be re-triggered, so work out the sleep length between triggers 
-         * The measured Function Calling overhead averages at around 10k to 20k ticks
-         * whereas a typical Step length would be between 200k and, perhaps, 1m2, so taking
-         * off 10k for the function calling overhead feels about right
-         */
-        int sleep_time = ((step_ticks - 10000) / pGate->ratchets)/2;
-
-        int i;
-        for (i = 0; i < pGate->ratchets; i++){
-            // Ratchet is ON
-            if(polyrhythm(pGate->ratchets,pGate->fill,i)){
-                /* Gate On */
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,1);
-                usleep(sleep_time);
-                /* Gate Off */
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
-                usleep(sleep_time);
-            }
-            else {
-                // Ratchet is OFF - make sure Gate is OFF just in case
-                // an Off Ratchet follows an ON gate!
-                GATESingleOutput(pGate->i2c_handle, pGate->i2c_channel,pGate->i2c_device,0);
-                usleep(sleep_time * 2);
-            }
-        }
+        // Ratchet is OFF - make sure Gate is OFF just in case
+        // an Off Ratchet follows an ON gate!
+        gate_stage(pGate,0);
+        ev->count++;
     }
-    free(pGate);
-	return(0);
-}
-/*
- * MIDI Thread - Joinable thread launched
- * for each MIDI Minion (ie up to 4 of these
- * could be running)
- */
-void *MidiThread(void *arg)
-{
-    struct midiChnl *pMidiChnl = (struct midiChnl *)arg;
-	int fd = pMidiChnl->i2c_handle;
-    int ret_val;
-    while (!ThreadEnd){
-        if(i2cReadByteData(fd,SC16IS750_RXLVL) > 0) {
-            ret_val = i2cReadByteData(fd,SC16IS750_RHR); 
-            /* Only react to MIDI Clock etc if Clock Source is External */
-            if (clock_source == EXT_CLK) {
-                switch(ret_val){
-                    case Clock:
-                        if(run_stop == RUN){
-                            if(midi_clock_counter++ >= (midi_clock_divisor -1)){
-                                midi_clock_counter = 0;
-                                GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,HIGH);
-                                next_step();
-                            }
-                            if(midi_clock_counter == (midi_clock_divisor / 2)){
-                                GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,LOW);
-                            }
-                        }
-                    break;
-                    case Start:
-                        /* MIDI Start re-starts the sequence from Step One */
-                        run_stop = RUN;
-                        step_one = TRUE;
-                        midi_clock_counter = 0;
-                        next_step();
-                    break;
-                    case Continue:
-                        run_stop = RUN;
-                    break;
-                    case Stop:
-                        run_stop = STOP;
-                    break;
-                }
-            }
-        }
+    // Go straight to the next ratchet that sounds
+    to_come = (ev->count < EUCLID_MAX_STEPS) ? (pGate->rhythm >> ev->count) : 0;
+    if(to_come != 0) ev->count += __builtin_ctzll(to_come);
+    if((to_come == 0) || (ev->count >= pGate->ratchets)){
+        gate_free(pGate);
+        return FALSE;
     }
-    return NULL;
+    ev->deadline = ratchet_edge(ev->start, pGate, 2 * ev->count);
+    return TRUE;
 }
 /*
  * Delay thread, which sleeps for the passed time
@@ -911,6 +863,18 @@ int startup(void)
 	if (pthread_mutex_init(&pcf8574_lock, NULL) != 0){
         log_msg("PCF8574 mutex init failed\n");
     }
+	if (pthread_mutex_init(&dac8574_lock, NULL) != 0){
+        log_msg("DAC8574 mutex init failed\n");
+    }
+	// Choose between real and simulated I2C devices
+	hal_init();
+	// Launch the Bus thread that carries out all the I2C writes
+	i2c_start();
+	// Launch the Scheduler that times all the Gate, Slew and Envelope outputs
+	sched_start();
+	// Empty Output Plans for every track, until a sequence is published
+	plan_init();
+	song_init();
 	 // Initialise the Europi structure 
 	int channel;
 	for(channel=0;channel < MAX_CHANNELS;channel++){
@@ -921,8 +885,12 @@ int startup(void)
 	// older boards, and Bus 1 on the later ones
 	hw_version = gpioHardwareRevision();
 	log_msg("Running on hw_revision: %d\n",hw_version);
-	// PIGPIO Function initialisation
-	if (gpioInitialise()<0) return 1;
+	// PIGPIO Function initialisation. Without real hardware, we can
+	// carry on regardless with the simulated I2C bus
+	if (gpioInitialise()<0) {
+		if (impersonate_hw == FALSE) return 1;
+		log_msg("pigpio unavailable - GPIO disabled\n");
+	}
 	// TEMP for testing with the K-Sharp screen
 	// Use one of the buttons to quit the app
 	gpioSetMode(BUTTON1_IN, PI_INPUT);
@@ -960,6 +928,15 @@ int startup(void)
 	gpioSetAlertFunc(BUTTON4_IN, button_4);
 	gpioSetAlertFunc(ENCODER_BTN, encoder_button);
 	//gpioSetAlertFunc(TOUCH_INT, touch_interrupt);
+#ifdef MIDI_IRQ_IN
+	/* The SC16IS750 IRQ output is open drain, so all the MIDI Minions can share one line */
+	if (impersonate_hw == FALSE) {
+		gpioSetMode(MIDI_IRQ_IN, PI_INPUT);
+		gpioSetPullUpDown(MIDI_IRQ_IN, PI_PUD_UP);
+		gpioSetAlertFunc(MIDI_IRQ_IN, midi_interrupt);
+		midi_irq = TRUE;
+	}
+#endif
 	gpioSetAlertFunc(CLOCK_IN, external_clock);
 	gpioSetAlertFunc(RUNSTOP_IN, runstop_input);
 	gpioSetAlertFunc(INTEXT_IN, clocksource_input);
@@ -1065,8 +1042,7 @@ int startup(void)
 	/* Start the internal sequencer clock */
 	run_stop = STOP;		/* master clock is running, but step generator is halted */
 	select_first_track();	// Default select the first enabled track
-	gpioHardwarePWM(MASTER_CLK,clock_freq,500000);
-	gpioSetAlertFunc(MASTER_CLK, master_clock);
+	clock_start();
 	prog_running = 1;
 	
     return(0);
@@ -1105,7 +1081,7 @@ int shutdown(void)
 	/* clear down all CV / Gate outputs */
 	for (track = 0;track < MAX_TRACKS; track++){
 		/* set the CV for each channel to the Zero level*/
-		if (Europi.tracks[track].channels[0].enabled == TRUE ){
+		if ((Europi.tracks[track].channels[0].enabled == TRUE) && (Europi.tracks[track].channels[0].type != CHNL_TYPE_MIDI)){
 			DACSingleChannelWrite(track,Europi.tracks[track].channels[0].i2c_handle, Europi.tracks[track].channels[0].i2c_address, Europi.tracks[track].channels[0].i2c_channel, Europi.tracks[track].channels[0].scale_zero);
 		}
 		/* set the Gate State for each channel to OFF*/
@@ -1116,6 +1092,8 @@ int shutdown(void)
        Europi_hw.hw_tracks[track].hw_channels[CV_OUT].scale_zero = Europi.tracks[track].channels[CV_OUT].scale_zero;
        Europi_hw.hw_tracks[track].hw_channels[CV_OUT].scale_max = Europi.tracks[track].channels[CV_OUT].scale_max;
 	}
+	/* and don't leave any MIDI notes hanging */
+	MIDIAllNotesOff();
     /* Save the current Hardware config */
     FILE * file = fopen("resources/hardware.conf","wb");
     if (file != NULL) {
@@ -1156,6 +1134,7 @@ int shutdown(void)
 	// destroy the Mutex locks for the mcp23008, pcf8574
 	pthread_mutex_destroy(&mcp23008_lock);
 	pthread_mutex_destroy(&pcf8574_lock);
+	pthread_mutex_destroy(&dac8574_lock);
 	return(0);
  }
 
@@ -1330,6 +1309,7 @@ void encoder_callback(int gpio, int level, uint32_t tick){
 							if(Europi.tracks[track].channels[CV_OUT].scale_zero <= 65535-vel){
 							Europi.tracks[track].channels[CV_OUT].scale_zero += vel;
 							DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].scale_zero);
+							plan_publish(track);
 							}
 							break;
 						}
@@ -1343,6 +1323,7 @@ void encoder_callback(int gpio, int level, uint32_t tick){
 							if(Europi.tracks[track].channels[CV_OUT].scale_zero >= vel){
 							Europi.tracks[track].channels[CV_OUT].scale_zero -= vel;
 							DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].scale_zero);
+							plan_publish(track);
 							}
 							break;
 						}
@@ -1614,20 +1595,20 @@ int EuropiFinder()
 	int retval;
 	int DACHandle;
 	unsigned pcf_addr = PCF_BASE_ADDR;
-	unsigned pcf_handle = i2cOpen(1,pcf_addr,0);
+	unsigned pcf_handle = i2c_open(1,pcf_addr,0);
 	if(pcf_handle < 0)return -1;
 	// Unfortunately, this tends to retun a valid handle even though the
 	// device doesn't exist. The only way to really check it is there 
 	// to try writing to it, which will fail if it doesn't exist.
-	retval = i2cWriteByte(pcf_handle, (unsigned)(0xF0));
+	retval = hal->write_byte(pcf_handle, (unsigned)(0xF0));
 	// either that worked, or it didn't. Either way we
 	// need to close the handle to the device for the
 	// time being
-	i2cClose(pcf_handle);
+	hal->close(pcf_handle);
 	if(retval < 0) return -1;	
 	// pass back a handle to the DAC8574, 
 	// which will be on i2c Address 0x4C
-	DACHandle = i2cOpen(1,DAC_BASE_ADDR,0);
+	DACHandle = i2c_open(1,DAC_BASE_ADDR,0);
 	return DACHandle;
 }
 
@@ -1648,7 +1629,7 @@ int MidiMinionFinder(unsigned address)
 	unsigned i2cAddr;
 	int mid_handle;
 	i2cAddr = MID_BASE_ADDR | (address & 0x7);
-	mid_handle = i2cOpen(1,i2cAddr,0);
+	mid_handle = i2c_open(1,i2cAddr,0);
     //log_msg("MINION Addr: %x, Handle: %d\n",i2cAddr, mid_handle);
 	if (mid_handle < 0) return -1;
     /* just to make sure, write out something random
@@ -1656,10 +1637,10 @@ int MidiMinionFinder(unsigned address)
      * it is there, to prove we have an SC16IS750 present
      */
     rnd_val = rand() % 0xFFFF;
-	if(i2cWriteByteData(mid_handle,SC16IS750_SPR,rnd_val) !=0) return -1;   // Return on write failure
-    ret_val = i2cReadByteData(mid_handle,SC16IS750_SPR);
+	if(hal->write_byte_data(mid_handle,SC16IS750_SPR,rnd_val) !=0) return -1;   // Return on write failure
+    ret_val = hal->read_byte_data(mid_handle,SC16IS750_SPR);
     if(ret_val != rnd_val) {
-        i2cClose(mid_handle);   //for some reason this doesn't free up the handle for re-use but, hey ho.
+        hal->close(mid_handle);   //for some reason this doesn't free up the handle for re-use but, hey ho.
         return -1;    
     }
     else {
@@ -1681,40 +1662,21 @@ int MinionFinder(unsigned address)
 	unsigned i2cAddr;
 	if((address > 8) || (address < 0)) return -1;
 	i2cAddr = MCP_BASE_ADDR | (address & 0x7);
-	mcp_handle = i2cOpen(1,i2cAddr,0);
+	mcp_handle = i2c_open(1,i2cAddr,0);
 	if (mcp_handle < 0) return -1;
 	/* 
 	 * we have a valid handle, however whether there is actually
 	 * a device on this address can seemingly only be determined 
 	 * by attempting to write to it.
 	 */
-	 retval = i2cWriteWordData(mcp_handle, 0x00, (unsigned)(0x0));
+	 retval = hal->write_word_data(mcp_handle, 0x00, (unsigned)(0x0));
 	 // close the handle to the PCF8574 (it will be re-opened shortly)
-	 i2cClose(mcp_handle);
+	 hal->close(mcp_handle);
 	 if(retval < 0) return -1;
 	 i2cAddr = DAC_BASE_ADDR | (address & 0x3);
-	 handle = i2cOpen(1,i2cAddr,0);
+	 handle = i2c_open(1,i2cAddr,0);
 	 return handle;
 }
-/*
- * MIDI Single Channel Out.
- * This takes a CV Value, Channel etc, same as a
- * CV Output, though quantises the Note voltage
- * to a MIDI Note value
- */
-void MIDISingleChannelWrite(unsigned handle, uint8_t channel, uint8_t velocity, uint16_t voltage){
-    uint8_t note;
-	if(impersonate_hw == TRUE) return;
-    note = pitch2midi(voltage);
-    // log_msg("Handle: %d, Chnl: %d, Velocity: %d, MIDI Note: %d\n",handle,channel,velocity,note);
-    // Note On
-    i2cWriteByteData(handle,SC16IS750_IOSTATE,0x00);
-    i2cWriteByteData(handle,SC16IS750_RHR,(0x90 | (channel & 0x0F)));
-    i2cWriteByteData(handle,SC16IS750_RHR,note);
-    i2cWriteByteData(handle,SC16IS750_RHR,velocity);
-    i2cWriteByteData(handle,SC16IS750_IOSTATE,0xFF);
-}
-
 /* 
  * DAC8574 16-Bit DAC single channel write 
  * Channel, in this context is the full 6-Bit address
@@ -1724,22 +1686,137 @@ void MIDISingleChannelWrite(unsigned handle, uint8_t channel, uint8_t velocity,
  * [A3][A2] are significant, as they need to match
  * the state of the address lines on the DAC
  * The ctrl_reg needs to look like this:
- * [A3][A2][0][1][x][C1][C0][0]
+ * [A3][A2][L1][L0][x][C1][C0][0]
+ * The channel is output straight away, along with
+ * anything else that happens to be staged at the time.
  */
 void DACSingleChannelWrite(int track, unsigned handle, uint8_t address, uint8_t channel, uint16_t voltage){
-	uint16_t v_out;
-	uint8_t ctrl_reg;
-	if(impersonate_hw == TRUE) return;
+	DACStage(track, handle, address, channel, voltage);
+	DACFlush();
+}
+
+/*
+ * OUT_CACHE_HOLDS
+ * TRUE if the device is known to hold the passed value, with
+ * nothing else on its way to it
+ */
+static int out_cache_holds(uint32_t *pOut, uint16_t value)
+{
+	uint32_t out = __atomic_load_n(pOut, __ATOMIC_ACQUIRE);
+	return ((out & OUT_VALID) && ((out & OUT_VALUE_MASK) == value)) ? TRUE : FALSE;
+}
+
+/*
+ * OUT_CACHE_QUEUED
+ * Called before a write is queued - until it completes, what the
+ * device holds isn't known
+ */
+static void out_cache_queued(uint32_t *pOut)
+{
+	uint32_t out = __atomic_load_n(pOut, __ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(pOut, &out, (out + OUT_INFLIGHT) & ~OUT_VALID, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * OUT_CACHE_DONE
+ * Called (by the Bus thread, usually) once a write has completed or
+ * been dropped. The value only becomes known if the write worked,
+ * and it was the last one queued to the device
+ */
+static void out_cache_done(uint32_t *pOut, uint16_t value, int ok)
+{
+	uint32_t out = __atomic_load_n(pOut, __ATOMIC_ACQUIRE);
+	uint32_t next;
+	do {
+		next = (out & OUT_INFLIGHT_MASK) - OUT_INFLIGHT;
+		if((ok == TRUE) && (next == 0)) next = OUT_VALID | value;
+		else next |= out & OUT_VALUE_MASK;
+	} while(!__atomic_compare_exchange_n(pOut, &out, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+/* done() callbacks for the writes that go through the output caches */
+static void dac8574_done(const struct i2c_req *req, int ok)
+{
+	int i;
+	if(req->handle >= I2C_MAX_HANDLES) return;
+	for(i = 0; (i + 2) < req->len; i += 3){
+		out_cache_done(&dac8574_out[req->handle][(req->data[i] >> 1) & 0x03], ((uint8_t)req->data[i + 1] << 8) | (uint8_t)req->data[i + 2], ok);
+	}
+}
+
+static void mcp23008_done(const struct i2c_req *req, int ok)
+{
+	if(req->handle < I2C_MAX_HANDLES) out_cache_done(&mcp23008_out[req->handle], (uint8_t)req->data[0], ok);
+}
+
+static void pcf8574_done(const struct i2c_req *req, int ok)
+{
+	out_cache_done(&pcf8574_out, (uint8_t)req->data[0], ok);
+}
+
+/*
+ * DACStage
+ * Records the value for a DAC8574 channel without touching
+ * the bus. DACFlush() then writes every staged channel on
+ * each DAC in a single I2C transaction, and has all four
+ * channels update at the same instant. A value that is the
+ * same as the one last written to the channel is dropped.
+ */
+void DACStage(int track, unsigned handle, uint8_t address, uint8_t channel, uint16_t voltage){
+	if(handle >= I2C_MAX_HANDLES) return;
     if(TuningOn == TRUE) {
         //Output the Global tuning voltage scaled by this Channel's scale factor
         voltage = scale_value(track,TuningVoltage);
     }
-	//log_msg("%d, %d, %d, %d\n",handle,address,channel,voltage);
-	ctrl_reg = (((address & 0xC) << 4) | 0x10) | ((channel << 1) & 0x06);
-	//log_msg("handle: %0x, address: %0x, channel: %d, ctrl_reg: %02x, Voltage: %d\n",handle, address, channel,ctrl_reg,voltage);
-	//swap MSB & LSB because i2cWriteWordData sends LSB first, but the DAC expects MSB first
-	v_out = ((voltage >> 8) & 0x00FF) | ((voltage << 8) & 0xFF00);
-	i2cWriteWordData(handle,ctrl_reg,v_out);
+	channel &= 0x03;
+	pthread_mutex_lock(&dac8574_lock);
+	if(out_cache_holds(&dac8574_out[handle][channel], voltage) == TRUE){
+		// Already on the output, so there's nothing to write (and
+		// anything different staged earlier is no longer wanted)
+		dac8574_dirty[handle] &= ~(0x01 << channel);
+	}
+	else {
+		dac8574_value[handle][channel] = voltage;
+		dac8574_dirty[handle] |= (0x01 << channel);
+		dac8574_address[handle] = address;
+	}
+	pthread_mutex_unlock(&dac8574_lock);
+}
+
+/*
+ * DACFlush
+ * Writes out every staged DAC8574 channel. All but the last
+ * staged channel on each DAC are written with Load mode 00, which
+ * just fills the channel's temporary register, then the last one
+ * is written with Load mode 10 which loads all four DAC registers
+ * together. The whole lot goes out as one I2C write of
+ * [ctrl][MSB][LSB] triplets. Every DAC write goes on the CV lane,
+ * so a Step CV can't be overtaken by an older Slew point.
+ */
+void DACFlush(void){
+	char buf[12];
+	unsigned handle;
+	int channel;
+	int count;
+	int remaining;
+	uint8_t load;
+	pthread_mutex_lock(&dac8574_lock);
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		if(dac8574_dirty[handle] == 0) continue;
+		count = 0;
+		remaining = __builtin_popcount(dac8574_dirty[handle]);
+		for(channel = 0; channel < 4; channel++){
+			if(!(dac8574_dirty[handle] & (0x01 << channel))) continue;
+			load = (--remaining == 0) ? DAC8574_LOADALL : DAC8574_STORE;
+			buf[count++] = ((dac8574_address[handle] & 0xC) << 4) | load | ((channel << 1) & 0x06);
+			buf[count++] = (dac8574_value[handle][channel] >> 8) & 0xFF;
+			buf[count++] = dac8574_value[handle][channel] & 0xFF;
+			out_cache_queued(&dac8574_out[handle][channel]);
+		}
+		dac8574_dirty[handle] = 0;
+		i2c_write_device(I2C_LANE_CV, handle, buf, count, dac8574_done);
+	}
+	pthread_mutex_unlock(&dac8574_lock);
 }
 /* 
  * GATEMultiOutput
@@ -1753,34 +1830,33 @@ void DACSingleChannelWrite(int track, unsigned handle, uint8_t address, uint8_t
  */
 void GATEMultiOutput(unsigned handle, uint8_t value)
 {
-	if(impersonate_hw == TRUE) return;
-	i2cWriteByteData(handle, 0x09,value);	
+	// This goes round the shadow state, but the cache still follows
+	// it, so the next flush puts the shadow state back if it differs
+	if(handle >= I2C_MAX_HANDLES) return;
+	out_cache_queued(&mcp23008_out[handle]);
+	i2c_write_byte_data(I2C_LANE_GATE, handle, 0x09,value, mcp23008_done);
 }
 /*
- * Outputs the passed value to the GATE output identified
+ * GATEStage
+ * Records the passed value for the GATE output identified
  * by the Handle to the Open device, and the channel (0-3)
- * As this is just a single bit, this function has to 
- * read the current state of the other gates on the GPIO
- * extender, incorporate this value, then write everything
- * back.
+ * in the shadow copy of the GPIO extender's port, and marks
+ * the device as needing a write, but doesn't touch the bus.
+ * GATEFlush() then writes each changed device just once, so
+ * all the gates that change on a clock tick cost one bus
+ * transaction per Minion, and change at the same instant.
  * Note that, on the Minion, the Gates are on GPIO Ports 0 to 3, 
  * though the gate indicator LEDs are on GPIO Ports 4 to 7, so
  * the output values from ports 0 to 3 need to be mirrored
  * to ports 4 - 7
- * The i2c Protocols are different for the PCF8574 used on the 
- * Europi, and the MCP23008 used on the Minions, and the MCP23008
- * will drive an LED from its High output, but the PCF8574 will
- * only pull it low!
- * A Mutex protects the read-update-write cycle for the MCP23008
- * as race conditions can exist due to the fact that multiple
- * threads can be attempting the same opersation at the same time
- */ 
-void GATESingleOutput(unsigned handle, uint8_t channel,int Device,int Value)
+ * The MCP23008 will drive an LED from its High output, but
+ * the PCF8574 will only pull it low!
+ */
+void GATEStage(unsigned handle, uint8_t channel,int Device,int Value)
 {
-	//log_msg("handle: %d, channel: %d, Device: %d, Value: %d\n",handle,channel,Device,Value);
-	uint8_t curr_val;
-	if(impersonate_hw == TRUE) return;
 	if(Device == DEV_MCP23008){
+		if(handle >= I2C_MAX_HANDLES) return;
+		pthread_mutex_lock(&mcp23008_lock);
 		if (Value > 0){
 			// Set corresponding bit high
 			mcp23008_state[handle] |= (0x01 << channel);
@@ -1791,24 +1867,8 @@ void GATESingleOutput(unsigned handle, uint8_t channel,int Device,int Value)
 			mcp23008_state[handle] &= ~(0x01 << channel);
 			mcp23008_state[handle] &= ~(0x01 << (channel + 4));
 		}
-		i2cWriteByteData(handle, 0x09,mcp23008_state[handle]);
-		
-		/*
-		pthread_mutex_lock(&mcp23008_lock);
-		curr_val = i2cReadByteData(handle, 0x09);
-		if (Value > 0){
-			// Set corresponding bit high
-			curr_val |= (0x01 << channel);
-			curr_val |= (0x01 << (channel + 4));
-		}
-		else {
-			// Set corresponding bit low
-			curr_val &= ~(0x01 << channel);
-			curr_val &= ~(0x01 << (channel + 4));
-		}
-		i2cWriteByteData(handle, 0x09,curr_val);
+		mcp23008_dirty[handle] = TRUE;
 		pthread_mutex_unlock(&mcp23008_lock);
-		*/
 	}
 	else if (Device == DEV_PCF8574){
 		/* The PCF8574 will only turn an LED on
@@ -1833,10 +1893,74 @@ void GATESingleOutput(unsigned handle, uint8_t channel,int Device,int Value)
 			// the equivalent in the MS Nibble needs to be high to turn the LED off
 			PCF8574_state |= (0x01 << (channel+4));
 		}
-		i2cWriteByte(handle,PCF8574_state);
+		pcf8574_handle = handle;
+		pcf8574_dirty = TRUE;
 		pthread_mutex_unlock(&pcf8574_lock);
 	}
 }
+
+/*
+ * GATEFlush
+ * Writes the shadow port state out to every GPIO extender
+ * that has had gate changes staged since the last flush,
+ * unless the port already holds that value (eg a Gate
+ * that was turned on and off again within the same tick).
+ * The write happens with the device's lock held so that
+ * writes to any one device always go out in order
+ */
+void GATEFlush(void)
+{
+	int handle;
+	pthread_mutex_lock(&mcp23008_lock);
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		if(mcp23008_dirty[handle] == TRUE){
+			mcp23008_dirty[handle] = FALSE;
+			if(out_cache_holds(&mcp23008_out[handle], mcp23008_state[handle]) == TRUE) continue;
+			out_cache_queued(&mcp23008_out[handle]);
+			i2c_write_byte_data(I2C_LANE_GATE, handle, 0x09,mcp23008_state[handle], mcp23008_done);
+		}
+	}
+	pthread_mutex_unlock(&mcp23008_lock);
+	pthread_mutex_lock(&pcf8574_lock);
+	if(pcf8574_dirty == TRUE){
+		pcf8574_dirty = FALSE;
+		if(out_cache_holds(&pcf8574_out, PCF8574_state) == FALSE){
+			out_cache_queued(&pcf8574_out);
+			i2c_write_byte(I2C_LANE_GATE, pcf8574_handle,PCF8574_state, pcf8574_done);
+		}
+	}
+	pthread_mutex_unlock(&pcf8574_lock);
+}
+
+/*
+ * OutputCacheInvalidate
+ * Forgets the last values written to every DAC channel and
+ * GPIO extender port, so the next write to each one goes out
+ * whatever its value. Needed whenever the devices may have
+ * been written to behind the caches' back, eg by the hardware
+ * scan, or when a device has just been found
+ */
+void OutputCacheInvalidate(void)
+{
+	int handle, channel;
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		for(channel = 0; channel < 4; channel++) __atomic_and_fetch(&dac8574_out[handle][channel], ~OUT_VALID, __ATOMIC_ACQ_REL);
+		__atomic_and_fetch(&mcp23008_out[handle], ~OUT_VALID, __ATOMIC_ACQ_REL);
+	}
+	__atomic_and_fetch(&pcf8574_out, ~OUT_VALID, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Outputs the passed value to the GATE output identified
+ * by the Handle to the Open device, and the channel (0-3)
+ * straight away, along with anything else that happens
+ * to be staged at the time.
+ */ 
+void GATESingleOutput(unsigned handle, uint8_t channel,int Device,int Value)
+{
+	GATEStage(handle, channel, Device, Value);
+	GATEFlush();
+}
 /*
  * Initialises all the hardware ports - scanning for connected
  * Minions etc.
@@ -1862,57 +1986,10 @@ void hardware_init(void)
 	}
     last_track = 0;
 	/*
-	 * If impersonate_hw is set to TRUE, then this bypasses the 
-	 * hardware checks, and pretends all hardware is present - this
-	 * is useful when testing the software without the full hardware
-	 * present
+	 * If impersonate_hw is set to TRUE, then hal_init() will have
+	 * switched over to the simulated I2C bus, which is populated with
+	 * a model of a full rig, so the normal scan below will find that
 	 */
-	 if (impersonate_hw == TRUE){
-		 is_europi = TRUE;
-		 log_msg("Impersonating Europi Hardware\n");
-		 for (track = 0; track < MAX_TRACKS;track++){
-			/* These are just dummy values to fool the software
-			 * into thinking it has the full hardware present
-			 */
-			Europi.tracks[track].channels[CV_OUT].enabled = TRUE;
-			Europi.tracks[track].channels[CV_OUT].type = CHNL_TYPE_CV;
-			Europi.tracks[track].channels[CV_OUT].function = CV;
-			Europi.tracks[track].channels[CV_OUT].quantise = 0;			/* Quantization off by default */
-			Europi.tracks[track].channels[CV_OUT].i2c_handle = track;			
-			Europi.tracks[track].channels[CV_OUT].i2c_device = DEV_DAC8574;
-			Europi.tracks[track].channels[CV_OUT].i2c_address = 0x0;
-			Europi.tracks[track].channels[CV_OUT].i2c_channel = 0;		
-			Europi.tracks[track].channels[CV_OUT].scale_zero = 280;		/* Value required to generate zero volt output */
-			Europi.tracks[track].channels[CV_OUT].scale_max = 63000;		/* Value required to generate maximum output voltage */
-			Europi.tracks[track].channels[CV_OUT].transpose = 0;			/* fixed (transpose) voltage offset applied to this channel */
-			Europi.tracks[track].channels[CV_OUT].octaves = 10;			/* How many octaves are covered from scale_zero to scale_max */
-			Europi.tracks[track].channels[CV_OUT].vc_type = VOCT;
-            Europi.tracks[track].channels[GATE_OUT].enabled = TRUE;
-			Europi.tracks[track].channels[GATE_OUT].type = CHNL_TYPE_GATE;
-			Europi.tracks[track].channels[GATE_OUT].i2c_handle = track;			
-			Europi.tracks[track].channels[GATE_OUT].i2c_device = DEV_PCF8574;
-			Europi.tracks[track].channels[GATE_OUT].i2c_channel = 0;
-            
-            /* note the equivalent in the Hardware structure */
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].enabled = TRUE;
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].type = CHNL_TYPE_CV;
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].i2c_handle = track;			
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].i2c_device = DEV_DAC8574;
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].i2c_address = 0x0;
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].i2c_channel = 0;		
-			Europi_hw.hw_tracks[track].hw_channels[CV_OUT].scale_zero = 280;		
-            Europi_hw.hw_tracks[track].hw_channels[CV_OUT].scale_max = 63000;		
-            Europi_hw.hw_tracks[track].hw_channels[GATE_OUT].enabled = TRUE;
-			Europi_hw.hw_tracks[track].hw_channels[GATE_OUT].type = CHNL_TYPE_GATE;
-			Europi_hw.hw_tracks[track].hw_channels[GATE_OUT].i2c_handle = track;			
-			Europi_hw.hw_tracks[track].hw_channels[GATE_OUT].i2c_device = DEV_PCF8574;
-			Europi_hw.hw_tracks[track].hw_channels[GATE_OUT].i2c_channel = 0;
-
-		 }
-		 last_track = MAX_TRACKS;
-		 select_track(0);
-		 return;
-	 }
 	/* 
 	 * Specifically look for a PCF8574 on address 0x38
 	 * if one exists, then it's on the Europi, so the first
@@ -1927,11 +2004,11 @@ void hardware_init(void)
 		is_europi = TRUE;
 		/* As this is a Europi, then there should be a PCF8574 GPIO Expander on address 0x38 */
 		pcf_addr = PCF_BASE_ADDR;
-		pcf_handle = i2cOpen(1,pcf_addr,0);
+		pcf_handle = i2c_open(1,pcf_addr,0);
 		if(pcf_handle < 0){log_msg("failed to open PCF8574 associated with DAC8574 on Addr: 0x08");}
 		if(pcf_handle >= 0) {
 			/* Gates off, LEDs off */
-			i2cWriteByte(pcf_handle, (unsigned)(0xF0));
+			hal->write_byte(pcf_handle, (unsigned)(0xF0));
             log_msg("Europi DAC8574 Addr:%0x, Handle:%0x, PCF8574 Addr:%0x Handle:%0x\n",DAC_BASE_ADDR,handle,PCF_BASE_ADDR,pcf_handle);
 		}
 		Europi.tracks[track].channels[CV_OUT].enabled = TRUE;
@@ -2027,18 +2104,22 @@ void hardware_init(void)
 	 * 0 - 7. Each Minion supports 4 Tracks
 	 */
 	for (address=0;address<=7;address++){
+		if(track + 4 > (MAX_TRACKS)){
+			log_msg("No room for any more Minion tracks\n");
+			break;
+		}
 		handle = MinionFinder(address);
 		if(handle >= 0){
 			log_msg("Minion Found on Address %d\n",address);
 			/* Get a handle to the associated MCP23008 */
 			mcp_addr = MCP_BASE_ADDR | (address & 0x7);	
-			gpio_handle = i2cOpen(1,mcp_addr,0);
+			gpio_handle = i2c_open(1,mcp_addr,0);
             log_msg("Minion DAC8574 Addr:%0x, Handle:%0x, MCP23008 Addr:%0x Handle:%0x\n",DAC_BASE_ADDR | (address & 0x3),handle,mcp_addr,gpio_handle);
 			if(gpio_handle < 0){log_msg("failed to open MCP23008 associated with DAC8574 on Addr: %0x\n",address);}
 			/* Set MCP23008 IO direction to Output, and turn all Gates OFF */
 			if(gpio_handle >= 0) {
-				i2cWriteWordData(gpio_handle, 0x00, (unsigned)(0x0));
-				i2cWriteByteData(gpio_handle, 0x09, 0x0);
+				hal->write_word_data(gpio_handle, 0x00, (unsigned)(0x0));
+				hal->write_byte_data(gpio_handle, 0x09, 0x0);
 				}
 			int i;
 			for(i=0;i<4;i++){
@@ -2113,6 +2194,10 @@ void hardware_init(void)
                 address=0x55;
                 break;            
         }
+        if(track >= (MAX_TRACKS)){
+            log_msg("No room for any more MIDI Minion tracks\n");
+            break;
+        }
         handle = MidiMinionFinder(address);
 		if(handle >= 0){
 			log_msg("MIDI Minion Found on Address %d\n",i);
@@ -2120,16 +2205,18 @@ void hardware_init(void)
             // Set the Baud Rate divisor = 4
             // Prescaler is set to 1, so Divisor = 2,000,000 / Baudrate * 16
             // MIDI Baud Rate = 31,250 so Divisor = 4
-            i2cWriteByteData(handle,SC16IS750_MCR,0x00);    // Prescaler = 1
-            if(i2cWriteByteData(handle,SC16IS750_LCR,0x83) !=0) log_msg("UART Write Failure\n");	//Line Control with Divisor Latch enabled
-            i2cWriteByteData(handle,SC16IS750_DLH,0x00);
-            i2cWriteByteData(handle,SC16IS750_DLL,0x04);
-            i2cWriteByteData(handle,SC16IS750_LCR,0x03); 	// Clear Divisor Latch. 8,1,none
-            i2cWriteByteData(handle,SC16IS750_FCR,0x01);    // Enable TX & Rx FIFO
+            hal->write_byte_data(handle,SC16IS750_MCR,0x00);    // Prescaler = 1
+            if(hal->write_byte_data(handle,SC16IS750_LCR,0x83) !=0) log_msg("UART Write Failure\n");	//Line Control with Divisor Latch enabled
+            hal->write_byte_data(handle,SC16IS750_DLH,0x00);
+            hal->write_byte_data(handle,SC16IS750_DLL,0x04);
+            hal->write_byte_data(handle,SC16IS750_LCR,0x03); 	// Clear Divisor Latch. 8,1,none
+            hal->write_byte_data(handle,SC16IS750_FCR,0x01);    // Enable TX & Rx FIFO
             // IO Control - gpio[7:4] set to behave as IO pins. All inputs non-latching
-            i2cWriteByteData(handle,SC16IS750_IOCONTROL,0x00);
+            hal->write_byte_data(handle,SC16IS750_IOCONTROL,0x00);
             // Set IO Direction (all Output)
-            i2cWriteByteData(handle,SC16IS750_IODIR,0xFF);
+            hal->write_byte_data(handle,SC16IS750_IODIR,0xFF);
+            // Interrupt on RX data (FIFO at its trigger level, or RX timeout) if the IRQ line is wired
+            hal->write_byte_data(handle,SC16IS750_IER,(midi_irq == TRUE) ? 0x01 : 0x00);
             // finally, set up the Track object for this MIDI channel
             Europi.tracks[track].channels[CV_OUT].enabled = TRUE;
             Europi.tracks[track].channels[CV_OUT].type = CHNL_TYPE_MIDI;
@@ -2161,6 +2248,7 @@ void hardware_init(void)
             // Launch a listening Thread
             struct midiChnl sMidiChnl; 
             sMidiChnl.i2c_handle = handle;
+            sMidiChnl.port = i;
             struct midiChnl *pMidiChnl = malloc(sizeof(struct midiChnl));
             memcpy(pMidiChnl, &sMidiChnl, sizeof(struct midiChnl));
             int error = pthread_create(&midiThreadId[i], NULL, MidiThread, pMidiChnl);
@@ -2174,6 +2262,10 @@ void hardware_init(void)
     }
     /* The last_track global can be used instead of MAX_TRACKS to reduce the size of loops*/
     last_track = track;
+    /* The scan wrote to the devices directly, so don't trust any cached output values */
+    OutputCacheInvalidate();
+    /* and the channels have all changed, so every track needs a new Output Plan */
+    plan_publish_all();
     log_msg("Last Track: %d\n",last_track);
 	/* All hardware identified - run through flashing each Gate just for fun */
 	if (is_europi == TRUE){
@@ -2196,9 +2288,9 @@ void hardware_init(void)
 				}
 				if (Europi.tracks[track].channels[chnl].type == CHNL_TYPE_MIDI){
                     // This just flashes the MIDI Out LED on a MIDI Minion
-                    i2cWriteByteData(Europi.tracks[track].channels[chnl].i2c_handle,SC16IS750_IOSTATE,0x00);
+                    hal->write_byte_data(Europi.tracks[track].channels[chnl].i2c_handle,SC16IS750_IOSTATE,0x00);
                     usleep(50000);
-                    i2cWriteByteData(Europi.tracks[track].channels[chnl].i2c_handle,SC16IS750_IOSTATE,0xFF);
+                    hal->write_byte_data(Europi.tracks[track].channels[chnl].i2c_handle,SC16IS750_IOSTATE,0xFF);
 				}
 			}
 		}
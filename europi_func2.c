@@ -58,6 +58,7 @@ extern char modal_dialog_txt3[];
 extern char modal_dialog_txt4[];
 extern int selected_step;
 extern struct europi Europi;
+extern struct playstate Playstate;
 extern struct europi_hw Europi_hw;
 //extern struct screen_overlays ScreenOverlays;
 extern uint32_t ActiveOverlays;
@@ -127,9 +128,9 @@ void seq_new(void){
 	select_first_track();	
 	for(track = 0;track < MAX_TRACKS;track++){
 		Europi.tracks[track].selected = FALSE;
-		Europi.tracks[track].track_busy = FALSE;
+		Playstate.track_busy[track] = FALSE;
 		Europi.tracks[track].last_step = 8;
-		Europi.tracks[track].current_step = 0;
+		Playstate.current_step[track] = 0;
 		Europi.tracks[track].channels[CV_OUT].quantise = 1;	// default quantization = semitones	
 		Europi.tracks[track].channels[CV_OUT].transpose = 0;	 
 		Europi.tracks[track].channels[CV_OUT].function = CV;
@@ -141,9 +142,11 @@ void seq_new(void){
 			Europi.tracks[track].channels[GATE_OUT].steps[step].ratchets = 1;
 			Europi.tracks[track].channels[GATE_OUT].steps[step].repetitions = 1;
 			Europi.tracks[track].channels[GATE_OUT].steps[step].fill = 0;
+			Europi.tracks[track].channels[GATE_OUT].steps[step].rotation = 0;
 			Europi.tracks[track].channels[GATE_OUT].steps[step].gate_type = Gate_Off;
 		}
 	}
+	plan_publish_all();
 }
 /*
  * Set all screen overlays OFF
@@ -313,17 +316,17 @@ void select_next_step(int dir){
     while (track < MAX_TRACKS){
         if(Europi.tracks[track].selected == TRUE){
             if (dir == 1) {
-                if (Europi.tracks[track].current_step < (Europi.tracks[track].last_step -1)) Europi.tracks[track].current_step++;
+                if (Playstate.current_step[track] < (Europi.tracks[track].last_step -1)) Playstate.current_step[track]++;
             }
             else {
-                if (Europi.tracks[track].current_step > 0) Europi.tracks[track].current_step--;
+                if (Playstate.current_step[track] > 0) Playstate.current_step[track]--;
             }
             break;
         }
         track++;
     }
     /* Output the current value for this track / step, so we can hear what's going on */
-    DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value);
+    DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value);
     // And turn the Gate output on
     GATESingleOutput(Europi.tracks[track].channels[GATE_OUT].i2c_handle, Europi.tracks[track].channels[GATE_OUT].i2c_channel,Europi.tracks[track].channels[GATE_OUT].i2c_device,0x01);
 }
@@ -387,6 +390,7 @@ void set_loop_point(int dir){
             if(Europi.tracks[track].selected == TRUE){
                 if(Europi.tracks[track].last_step < MAX_STEPS){
                     Europi.tracks[track].last_step++;
+                    plan_publish(track);
                 }
                 break;
             }
@@ -399,6 +403,7 @@ void set_loop_point(int dir){
             if(Europi.tracks[track].selected == TRUE){
                 if(Europi.tracks[track].last_step > 1){
                     Europi.tracks[track].last_step--;
+                    plan_publish(track);
                 }
                 break;
             }
@@ -416,67 +421,68 @@ void select_next_slew(int dir){
     while (track < MAX_TRACKS){
         if(Europi.tracks[track].selected == TRUE){
             if (dir == 1) {
-                switch(Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type){
+                switch(Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type){
                     case Off:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Linear;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Linear;
                     break;
                     case Linear:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Exponential;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Exponential;
                     break;
                     case Exponential:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevExp;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevExp;
                     break;
                     case RevExp:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Log;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Log;
                     break;
                     case Log:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevLog;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevLog;
                     break;
                     case RevLog:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Sine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Sine;
                     break;
                     case Sine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevSine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevSine;
                     break;
                     case RevSine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Cosine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Cosine;
                     break;
                     case Cosine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Off;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Off;
                     break;
                 }
             }
             else {
-                switch(Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type){
+                switch(Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type){
                     case Off:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Cosine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Cosine;
                     break;
                     case Linear:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Off;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Off;
                     break;
                     case Exponential:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Linear;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Linear;
                     break;
                     case RevExp:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Exponential;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Exponential;
                     break;
                     case Log:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevExp;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevExp;
                     break;
                     case RevLog:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Log;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Log;
                     break;
                     case Sine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevLog;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevLog;
                     break;
                     case RevSine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = Sine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = Sine;
                     break;
                     case Cosine:
-                        Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type = RevSine;
+                        Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type = RevSine;
                     break;
                 }
             }
+            plan_publish(track);
             break;
         }
         track++;
@@ -548,6 +554,7 @@ void select_next_direction(int dir){
                     break;
                 }
             }
+            plan_publish(track);
             break;
         }
         track++;
@@ -567,7 +574,7 @@ void set_step_pitch(int dir, int vel){
                 if(dir == UP){
                     // move the raw value of this step up until the next quantisation 
                     // boundary is passed
-                    raw_val = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value;
+                    raw_val = Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value;
                     current = quantize(raw_val,Europi.tracks[track].channels[CV_OUT].quantise);
                     newpitch = current;
                     while((current == newpitch) && (raw_val <= 60000)){
@@ -578,11 +585,11 @@ void set_step_pitch(int dir, int vel){
                     if(raw_val > 60000) raw_val = 60000;
                     // We've got a new raw value that returns a different quantised value
                     log_msg("newpitch: %d\n",newpitch);
-                    Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value = newpitch;
-                    Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value = scale_value(track,newpitch);
+                    Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value = newpitch;
+                    Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value = scale_value(track,newpitch);
                 }
                 else{
-                    raw_val = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value;
+                    raw_val = Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value;
                     current = quantize(raw_val,Europi.tracks[track].channels[CV_OUT].quantise);
                     newpitch = current;
                     while((current == newpitch) && (raw_val > 0)){
@@ -593,25 +600,26 @@ void set_step_pitch(int dir, int vel){
                     if(raw_val < 0) raw_val = 0;
                     // We've got a new raw value that returns a different quantised value
                     log_msg("newpitch: %d\n",newpitch);
-                    Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value = newpitch;
-                    Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value = scale_value(track,newpitch);
+                    Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value = newpitch;
+                    Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value = scale_value(track,newpitch);
                 }
-                Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value; //= (uint16_t)(output_scaling * quantized) + Europi.tracks[track].channels[CV_OUT].scale_zero;
-                DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value);
+                Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value = Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value; //= (uint16_t)(output_scaling * quantized) + Europi.tracks[track].channels[CV_OUT].scale_zero;
+                DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value);
             }
             else {
                 // unquantised tracks use the velocity to move
                 // the pitch up or down as appropriate
                 if(vel > 3) vel *= 10;
                 if (dir == 1) {
-                    if (Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value <= (60000 - vel)) Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value += vel;
+                    if (Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value <= (60000 - vel)) Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value += vel;
                 }
                 else {
-                    if (Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value >= vel) Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value -= vel;
+                    if (Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value >= vel) Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value -= vel;
                 }
-                Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value = Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value; //= (uint16_t)(output_scaling * quantized) + Europi.tracks[track].channels[CV_OUT].scale_zero;
-                DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].scaled_value);
+                Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value = Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value; //= (uint16_t)(output_scaling * quantized) + Europi.tracks[track].channels[CV_OUT].scale_zero;
+                DACSingleChannelWrite(track,Europi.tracks[track].channels[CV_OUT].i2c_handle, Europi.tracks[track].channels[CV_OUT].i2c_address, Europi.tracks[track].channels[CV_OUT].i2c_channel, Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].scaled_value);
             }            
+            plan_publish(track);
             break;
         }
 	}
@@ -769,10 +777,7 @@ void file_save(void){
 	ClearScreenOverlays();
     ClearMenus();
     MenuSelectItem(0,0);
-	FILE * file = fopen(current_filename,"wb");
-	if (file != NULL) {
-		fwrite(&Europi,sizeof(struct europi),1,file);
-		fclose(file);
+	if (sequence_save(current_filename) == 0) {
         log_msg("Saved as: %s\n",current_filename);
 	}
     else{
@@ -891,6 +896,18 @@ void config_setten(void){
 	ActiveOverlays &= !ovl_MainMenu;
  }
 
+/*
+ * menu callback to write the I2C Bus telemetry out
+ * as CSV, for capacity planning
+ */
+ void config_i2cstats(void){
+    save_run_stop = run_stop;
+    if(i2c_stats_dump("resources/i2c_stats.csv") == 0) log_msg("I2C stats written to resources/i2c_stats.csv\n");
+    ClearMenus();
+    MenuSelectItem(0,0);
+	ActiveOverlays &= !ovl_MainMenu;
+ }
+
 
 /* 
  * Set the zero volt level for the passed Track
@@ -898,6 +915,7 @@ void config_setten(void){
 void set_zero(int Track, long ZeroVal){
 	if(Europi.tracks[Track].channels[CV_OUT].enabled == TRUE){
 		Europi.tracks[Track].channels[CV_OUT].scale_zero = ZeroVal;
+		plan_publish(Track);
 	}
 }
 
@@ -911,16 +929,10 @@ void file_quit(void){
 /*
  * load_sequence()
  * Reads the specified sequence 
- * TODO: Probably ought to worry about whether
- * the sequence being read is the same size & shape
- * as our Europi Object?
  */
 void load_sequence(const char *filename){
     sprintf(current_filename,"%s",filename);
-	FILE * file = fopen(filename,"rb");
-	if (file != NULL) {
-		fread(&Europi, sizeof(struct europi), 1, file);
-		fclose(file);
+	if (sequence_load(filename) == 0) {
         // note the file we've just opened
         sprintf(current_filename,"%s",filename);
         log_msg("Current: %s\n",current_filename);
@@ -975,6 +987,7 @@ void slew_adjust(int dir, int vel){
 				}
 			
 		}
+		plan_publish(0);
 	}
 }
 
@@ -1020,6 +1033,7 @@ void step_repeat(int dir, int vel){
 					break;
 			}
 		}
+		plan_publish(0);
 	}
 }
 
@@ -1027,11 +1041,7 @@ void init_sequence_old1(void)
 {
     sprintf(current_filename,"resources/sequences/default.seq");
     log_msg("Init Seq: %s\n",current_filename);
-	FILE * file = fopen(current_filename,"rb");
-	if (file != NULL) {
-		fread(&Europi, sizeof(struct europi), 1, file);
-		fclose(file);
-	}
+	sequence_load(current_filename);
 }
 
 
@@ -1048,7 +1058,7 @@ void init_sequence(void)
 	//Temp - set all outputs to 0
 	for (track=0;track<MAX_TRACKS;track++){
 		if (Europi.tracks[track].channels[CV_OUT].enabled == TRUE){
-			Europi.tracks[track].track_busy = FALSE;
+			Playstate.track_busy[track] = FALSE;
             Europi.tracks[track].direction = Forwards;
 			Europi.tracks[track].last_step =  8; //rand() % 32;
 
@@ -1133,7 +1143,6 @@ void init_sequence(void)
                 Europi.tracks[track].channels[1].steps[step].ratchets = 8;
                 Europi.tracks[track].channels[1].steps[step].fill = rand()%8;
                 Europi.tracks[track].channels[1].steps[step].repetitions = 1;
-                Europi.tracks[track].channels[1].steps[step].repeat_counter = 0;
 			}
             
 			// some ratchets to make it more interesting
@@ -1198,7 +1207,7 @@ void init_sequence(void)
 		}
 		
 		}
-
+	plan_publish_all();
 }
 
 /*
@@ -1220,6 +1229,7 @@ void quantize_track(int track, int scale)
 		quantized = quantize(Europi.tracks[track].channels[CV_OUT].steps[step].raw_value, scale);
 		Europi.tracks[track].channels[CV_OUT].steps[step].scaled_value = (uint16_t)(output_scaling * quantized) + Europi.tracks[track].channels[CV_OUT].scale_zero;
 	}
+	plan_publish(track);
 }
 
 /*
@@ -1293,20 +1303,6 @@ int cstring_cmp(const void *a, const void *b)
     return strcmp(*ia, *ib);
 } 
 
-/* POLYRHYTHM
- * Takes the number of steps, the fill level, and which step we're on
- * and returns a True / False value as to whether that step should
- * sound or not.
- * 
- * This looks up that particular value in a pre-prepared table of 32x32
- * bitmaps. Prepared according to an implementation of E.Bjoklund's
- * algorithm
- */
-int polyrhythm(uint32_t steps, uint32_t fill, uint32_t ThisStep){
-    if(fill > steps) fill = steps;
-    if(steps > 32 || steps < 2) return TRUE;
-    return bjorklund_patterns[steps-2][fill] & (0x01 << ThisStep);
-}
 /* HARDWARE_CONFIG
  * Compares the current hardware configuration (as recorded at startup)
  * with the hardware config saved to disk and, if they are the same,
@@ -1347,6 +1343,7 @@ void hardware_config(void){
                 Europi.tracks[track].channels[CV_OUT].scale_zero = SavedConfig.hw_tracks[track].hw_channels[CV_OUT].scale_zero;
                 Europi.tracks[track].channels[CV_OUT].scale_max = SavedConfig.hw_tracks[track].hw_channels[CV_OUT].scale_max;
             }
+            plan_publish_all();
         }
         else{
             //Current Hardware Config is different to the saved config, so warn the user
@@ -27,7 +27,7 @@
 #include "europi.h"
 #include "../raylib/src/raylib.h"
 
-extern int clock_freq;
+extern int clock_bpm;
 extern int step_ticks;
 extern int prog_running;
 extern int run_stop; 
@@ -78,6 +78,7 @@ extern int edit_step;
 extern uint32_t ActiveOverlays;
 extern enum display_page_t DisplayPage;
 extern struct europi Europi;
+extern struct playstate Playstate;
 extern char **files;
 extern size_t file_count;                      
 extern int file_selected;
@@ -121,7 +122,7 @@ void gui_8x8(void){
     for(track = 0; track < 8; track++){
         // Can only display 8 tracks, so need to know which
         // track we are starting with, and display the next 7
-        offset = Europi.tracks[start_track+track].current_step / 8;
+        offset = Playstate.current_step[start_track+track] / 8;
         sprintf(txt,"%02d-%d:",start_track+track+1,(offset * 8)+1);
         txt_len = MeasureText(txt,20);
         DrawText(txt,68-txt_len,12+(vOffset+(track * 25)),20,DARKGRAY);
@@ -180,7 +181,7 @@ void gui_8x8(void){
                 // beyond the last step, just paint black squares
                 DrawRectangleRec(stepRectangle, BLACK); 
             }
-            else if((offset*8)+column == Europi.tracks[start_track+track].current_step){
+            else if((offset*8)+column == Playstate.current_step[start_track+track]){
                 // Paint current step
                 DrawRectangleRec(stepRectangle, LIME);   
             }
@@ -218,7 +219,7 @@ void gui_singlestep(void){
     // Step Repeat
     // DrawRectangle(6,29, 308, 183, CLR_LIGHTBLUE);  
     // Draw the current Track 8-Step segement
-    offset = edit_step / 8; //Europi.tracks[edit_track].current_step / 8;
+    offset = edit_step / 8; //Playstate.current_step[edit_track] / 8;
     sprintf(txt,"%02d-%d:",edit_track+1,(offset * 8)+1);
     txt_len = MeasureText(txt,20);
     DrawText(txt,68-txt_len,34,20,DARKGRAY);
@@ -257,7 +258,7 @@ void gui_singlestep(void){
                 // Paint last step
                 DrawRectangleRec(stepRectangle, BLACK); 
             }
-            else if((offset*8)+column == Europi.tracks[edit_track].current_step){
+            else if((offset*8)+column == Playstate.current_step[edit_track]){
                 // Paint current step
                 DrawRectangleRec(stepRectangle, LIME);   
             }
@@ -360,6 +361,7 @@ void gui_singlestep(void){
 						Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].slew_type = Cosine;
 				break;
 		 }
+		plan_publish(edit_track);
 	}
 
 	// Slew Shape
@@ -402,6 +404,7 @@ void gui_singlestep(void){
 						Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].slew_shape = Falling;
 				break;
 		 }
+		plan_publish(edit_track);
 	}
 
 	// Slew Length
@@ -417,6 +420,7 @@ void gui_singlestep(void){
 	if (CheckCollisionPointRec(touchPosition, touchRectangle) && (currentGesture != GESTURE_NONE)){
 		// Work out what % of the way along the touchRectangle we are
 		Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].slew_length = (int)(((float)(touchPosition.x - 8) / (float)128) * (float)500000);
+		plan_publish(edit_track);
 	}
 	
    
@@ -487,6 +491,7 @@ void gui_singlestep(void){
 						Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].gate_type = Gate_95;
 				break;
 		 }
+		plan_publish(edit_track);
 	}
 
 
@@ -501,6 +506,7 @@ void gui_singlestep(void){
     if (CheckCollisionPointRec(touchPosition, touchRectangle) && (currentGesture != GESTURE_NONE)){
 		// Work out what % of the way along the touchRectangle we are
 		Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].ratchets = (int)(((touchPosition.x - 8) / (float)128) * 16);
+		plan_publish(edit_track);
 	}
 	
     sprintf(txt,"%d",Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].fill);
@@ -513,6 +519,20 @@ void gui_singlestep(void){
     if (CheckCollisionPointRec(touchPosition, touchRectangle) && (currentGesture != GESTURE_NONE)){
 		// Work out what % of the way along the touchRectangle we are
 		Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].fill = (int)(((touchPosition.x - 8) / (float)128) * 16);
+		plan_publish(edit_track);
+	}
+
+    sprintf(txt,"%d",Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].rotation);
+    DrawText(txt,140,178,20,BLUE);    
+    touchRectangle.y = 178;
+	touchRectangle.width = (int)((Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].rotation/(float)16)*128);
+	DrawRectangleRec(touchRectangle, LIGHTGRAY);
+    DrawText("Rotate:",64,178,20,DARKGRAY);
+	touchRectangle.width = 128;
+    if (CheckCollisionPointRec(touchPosition, touchRectangle) && (currentGesture != GESTURE_NONE)){
+		// Work out what % of the way along the touchRectangle we are
+		Europi.tracks[edit_track].channels[GATE_OUT].steps[edit_step].rotation = (int)(((touchPosition.x - 8) / (float)128) * 16);
+		plan_publish(edit_track);
 	}
 
     // Draw the Pitch 'Bar Graph' display
@@ -533,6 +553,7 @@ void gui_singlestep(void){
             Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].raw_value = newpitch;
             // Update scaled value 
             Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].scaled_value = scale_value(edit_track,newpitch);
+            plan_publish(edit_track);
         }
     }
 
@@ -553,6 +574,7 @@ void gui_singlestep(void){
             Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].raw_value = newpitch;
             // Update scaled value 
             Europi.tracks[edit_track].channels[CV_OUT].steps[edit_step].scaled_value = scale_value(edit_track,newpitch);
+            plan_publish(edit_track);
         }
     }
     // Fill the partial column = this is the percentage of an 
@@ -583,7 +605,7 @@ void gui_singlestep(void){
         if(step == edit_step){
             DrawRectangleRec(touchRectangle,YELLOW);
         }
-        else if(step == Europi.tracks[edit_track].current_step){
+        else if(step == Playstate.current_step[edit_track]){
             DrawRectangleRec(touchRectangle,LIME);
         }
         else{
@@ -638,6 +660,7 @@ void gui_SingleChannel(void){
                         Europi.tracks[track].channels[CV_OUT].steps[SingleChannelOffset+column].raw_value = newpitch;
                         // Update scaled value 
                         Europi.tracks[track].channels[CV_OUT].steps[SingleChannelOffset+column].scaled_value = scale_value(track,newpitch);
+                        plan_publish(track);
                     }
                 }
                 //Column of Octave buttons
@@ -645,7 +668,7 @@ void gui_SingleChannel(void){
                     DrawRectangleLines(6+(column*39),(i*12)+32,15,10,BLACK);
                     if((9-i) == Octave){
                         // Colour the current Octave
-                        if(SingleChannelOffset+column == Europi.tracks[track].current_step){
+                        if(SingleChannelOffset+column == Playstate.current_step[track]){
                             DrawRectangle(6+(column*39)+1,(i*12)+32+1,13,8,LIME);
                         }
                         else{
@@ -664,13 +687,14 @@ void gui_SingleChannel(void){
                         Europi.tracks[track].channels[CV_OUT].steps[SingleChannelOffset+column].raw_value = newpitch;
                         // Update scaled value 
                         Europi.tracks[track].channels[CV_OUT].steps[SingleChannelOffset+column].scaled_value = scale_value(track,newpitch);
+                        plan_publish(track);
                     }
 
                 }
                 // Fill the partial column = this is the percentage of an 
                 // Octave, so 6000 would == 120 pixels
                 Pitch = (Partial * 120) / 6000;
-                if(SingleChannelOffset+column == Europi.tracks[track].current_step){
+                if(SingleChannelOffset+column == Playstate.current_step[track]){
                     DrawRectangle(22+(column*39)+1,30+120-Pitch,16,Pitch,LIME); 
                 }
                 else {
@@ -712,7 +736,7 @@ void gui_SingleChannel(void){
                 touchRectangle.height = 8;
                 touchRectangle.x = 6+(column*39);
                 Color gate_colour;
-                if(SingleChannelOffset+column == Europi.tracks[track].current_step){
+                if(SingleChannelOffset+column == Playstate.current_step[track]){
                     gate_colour = LIME;
                 }
                 else{
@@ -755,7 +779,7 @@ void gui_SingleChannel(void){
                         int GateWidth = 38 / Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].ratchets - 1;
                         touchRectangle.width = GateWidth;
                         for(i=0;i<Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].ratchets;i++){
-                            if(polyrhythm(Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].ratchets,Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].fill,i)){
+                            if(euclid(Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].ratchets,Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].fill,Europi.tracks[track].channels[GATE_OUT].steps[SingleChannelOffset+column].rotation) & ((uint64_t)1 << i)){
                                 DrawRectangleRec(touchRectangle,gate_colour);
                             }
                             touchRectangle.x += GateWidth + 1;
@@ -785,7 +809,7 @@ void gui_SingleChannel(void){
                 touchRectangle.y = 203;
                 touchRectangle.width = 8;
                 touchRectangle.height = 8;
-                if(step == Europi.tracks[track].current_step){
+                if(step == Playstate.current_step[track]){
                     DrawRectangleRec(touchRectangle,LIME);
                 }
                 else{
@@ -842,7 +866,7 @@ void gui_SingleAD(void){
             Origin.y = 210;
 
             // Draw the Vertex
-            y = Origin.y - 180*((float)Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value / (float)60000);
+            y = Origin.y - 180*((float)Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value / (float)60000);
             VertexCentre.x = 100;
             VertexCentre.y = y;
             DrawRectangleLines(VertexCentre.x-4,VertexCentre.y-4,8,8,BLACK);
@@ -936,7 +960,7 @@ void gui_SingleChannel_old2(void){
                     /* Width of the bar is the Octave */
                     stepRectangle.width = Octave+5;
                     stepRectangle.height = val;
-                    if(step == Europi.tracks[track].current_step){
+                    if(step == Playstate.current_step[track]){
                         DrawRectangleRec(stepRectangle,MAROON);
                     }
                     else{
@@ -1001,7 +1025,7 @@ void gui_SingleChannel_old1(void){
                     stepRectangle.y = ((row+1) * 100)-val;
                     stepRectangle.width = 15;
                     stepRectangle.height = val;
-                    if(step == Europi.tracks[track].current_step){
+                    if(step == Playstate.current_step[track]){
                         DrawRectangleRec(stepRectangle,MAROON);
                     }
                     else{
@@ -1053,7 +1077,7 @@ void gui_SingleChannel_Old(void){
             for (step = 0; step < MAX_STEPS; step++){
                 if(step < Europi.tracks[track].last_step){
                     val = (int)(((float)Europi.tracks[track].channels[CV_OUT].steps[step].scaled_value / (float)60000) * 220);
-                    if(step == Europi.tracks[track].current_step){
+                    if(step == Playstate.current_step[track]){
                         DrawRectangle(15 + (step*9),220-val,8,val,MAROON);
                     }
                     else{
@@ -1164,6 +1188,7 @@ void gui_grid(void){
                  else {
                     Europi.tracks[start_track+track].channels[GATE_OUT].steps[step].gate_type = Gate_50;
                 }
+                plan_publish(start_track+track);
             }
             else if (CheckCollisionPointRec(touchPosition, stepRectangle) && (currentGesture == GESTURE_TAP) && (step == Europi.tracks[track].last_step) && (OverlayActive(ovl_VerticalScrollBar) == 0)){
                 // Tap on last step - selects it for moving
@@ -1180,6 +1205,7 @@ void gui_grid(void){
                 // If last step on this track is selected, and current gesture is
                 // GESTURE_HOLD, then move the Last step to the current step
                 Europi.tracks[start_track+track].last_step = step;
+                plan_publish(start_track+track);
                 selected_step = step;
             }
             if(step == Europi.tracks[start_track+track].last_step){
@@ -1201,7 +1227,7 @@ void gui_grid(void){
                 // paint this step
                 if (Europi.tracks[start_track+track].channels[GATE_OUT].steps[step].gate_type != Gate_Off){
                     // Some sort of gate
-                    if(step == Europi.tracks[start_track+track].current_step){
+                    if(step == Playstate.current_step[start_track+track]){
                         DrawRectangleRec(stepRectangle,RED);
                         DrawRectangleLinesEx(stepRectangle,1,DARKGRAY);
                     }
@@ -1211,7 +1237,7 @@ void gui_grid(void){
                 }
                 else {
                     // Blank step (no gate)
-                    if(step == Europi.tracks[start_track+track].current_step){
+                    if(step == Playstate.current_step[start_track+track]){
                         DrawRectangleRec(stepRectangle,WHITE);
                         DrawRectangleLinesEx(stepRectangle,1,DARKGRAY);
                     }
@@ -1243,8 +1269,8 @@ void ShowScreenOverlays(void){
         gui_MainMenu();
     }
     if(ActiveOverlays & ovl_BPM){
-        char strBPM[10];
-        sprintf(strBPM,"%02d BPM",clock_freq);
+        char strBPM[16];
+        sprintf(strBPM,"%d.%02d BPM",clock_bpm / 100,clock_bpm % 100);
         DrawTexture(SmallDialogTexture,157,180,WHITE);
         DrawText(strBPM,167,188,20,DARKGRAY);
     }
@@ -1475,8 +1501,8 @@ void ShowScreenOverlays(void){
         for(track = 0; track < MAX_TRACKS; track++) {
             if (Europi.tracks[track].selected == TRUE){
                 sprintf(strTrack,"%02d",track+1);
-                sprintf(strStep,"%02d",Europi.tracks[track].current_step+1);
-                switch (Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].slew_type){
+                sprintf(strStep,"%02d",Playstate.current_step[track]+1);
+                switch (Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].slew_type){
                     default:
                     case Off:
                         DrawText("Off",228,5,20,DARKGRAY);
@@ -1581,8 +1607,8 @@ void ShowScreenOverlays(void){
         for(track = 0; track < MAX_TRACKS; track++) {
             if (Europi.tracks[track].selected == TRUE){
                 sprintf(strTrack,"%02d",track+1);
-                sprintf(strStep,"%02d",Europi.tracks[track].current_step+1);
-                sprintf(strPitch,"%05d",Europi.tracks[track].channels[CV_OUT].steps[Europi.tracks[track].current_step].raw_value);
+                sprintf(strStep,"%02d",Playstate.current_step[track]+1);
+                sprintf(strPitch,"%05d",Europi.tracks[track].channels[CV_OUT].steps[Playstate.current_step[track]].raw_value);
                 DrawText(strTrack,75,5,20,DARKGRAY);
                 DrawText(strStep,160,5,20,DARKGRAY);
                 DrawText(strPitch,250,5,20,DARKGRAY);
@@ -2158,10 +2184,7 @@ void gui_ButtonBar(void){
                     ClearMenus();
                     MenuSelectItem(0,0);
                     sprintf(current_filename,"resources/sequences/%s",input_txt);
-                    FILE * file = fopen(current_filename,"wb");
-                    if (file != NULL) {
-                        fwrite(&Europi,sizeof(struct europi),1,file);
-                        fclose(file);
+                    if (sequence_save(current_filename) == 0) {
                         log_msg("Saved as %s",current_filename);
                     }
                     else{
@@ -2213,9 +2236,8 @@ void gui_ButtonBar(void){
             DrawText("BPM-",177,217,20,DARKGRAY);
             if (btnC_state == 1){
                 btnC_state = 0;
-                clock_freq -= 10;
-                if (clock_freq < 1) clock_freq = 1;
-                gpioHardwarePWM(MASTER_CLK,clock_freq,500000);
+                clock_bpm -= 100;
+                if (clock_bpm < CLOCK_BPM_MIN) clock_bpm = CLOCK_BPM_MIN;
                 // Display the current BPM on a floating overlay
                 // and launch a timed Thread to turn it off
                 ActiveOverlays |= ovl_BPM;  // Display BPM Overlay
@@ -2283,8 +2305,8 @@ void gui_ButtonBar(void){
             DrawText("BPM+",257,217,20,DARKGRAY);
             if (btnD_state == 1){
                 btnD_state = 0;
-                clock_freq += 10;
-                gpioHardwarePWM(MASTER_CLK,clock_freq,500000);
+                clock_bpm += 100;
+                if (clock_bpm > CLOCK_BPM_MAX) clock_bpm = CLOCK_BPM_MAX;
                 // Display the current BPM on a floating overlay
                 // and launch a timed Thread to turn it off
                 ActiveOverlays |= ovl_BPM;  // Display BPM Overlay
@@ -2409,12 +2431,26 @@ void gui_MainMenu(void){
 * whatever else is going on on the screen. This
 * starts at the oldest message (ie the one that
 * will be overwritten next) that way the most recent
-* message will always be at the bottom of the screen
+* message will always be at the bottom of the screen.
+* A summary of the I2C Bus load is shown above it
 */
 void gui_debug(void){
     if(debug == FALSE) return;
     int i;
     int current_row = next_debug_slot;
+    int busiest = 0;
+    char bus_line[80];
+    struct i2c_bus_stats *stats = i2c_stats_sample();
+    for(i = 1; i < 128; i++){
+        if(stats->dev[i].byte_rate > stats->dev[busiest].byte_rate) busiest = i;
+    }
+    // I2C Bus summary line sits just above the message box
+    snprintf(bus_line,sizeof(bus_line),"I2C %u.%u%% (wire %u.%u%%) %u tx/s %u B/s top 0x%02X",
+        stats->busy_permille / 10, stats->busy_permille % 10,
+        stats->wire_permille / 10, stats->wire_permille % 10,
+        stats->tx_rate, stats->byte_rate, busiest);
+    DrawRectangle(5,88,310,12,WHITE);
+    DrawText(bus_line,7,89,10,BLACK);
     DrawRectangle(5,100,310,112,WHITE);
     for(i = 0; i <10; i++){
         DrawText(debug_messages[current_row++],7,104+(i*11),10,BLACK);
@@ -0,0 +1,459 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Hardware Abstraction Layer
+ *
+ * All I2C device access goes through the function pointers in
+ * the hal backend, rather than calling pigpio directly. Two
+ * backends are provided: hal_pigpio, which is just pigpio itself,
+ * and hal_sim, which is a software model of the devices found on
+ * the Europi and Minions (DAC8574, MCP23008, PCF8574, SC16IS750).
+ * The simulated bus models each device's registers, answers the
+ * hardware scan in the same way the real devices do, and takes as
+ * long as the real transfer would at 400kHz, so the whole sequencer
+ * can be run, and its bus throughput and latency measured, with no
+ * Europi hardware attached.
+ *
+ * MIDI In can be driven from outside by writing raw MIDI bytes
+ * to the SIM_MIDI_FIFO named pipe (eg with cat), which feeds them
+ * into the first simulated MIDI Minion's receive FIFO.
+ *
+ * Note that only the I2C side is abstracted - GPIO (buttons,
+ * encoder, clock inputs) still goes through pigpio directly.
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <pigpio.h>
+
+#include "europi.h"
+
+extern int impersonate_hw;
+extern int ThreadEnd;
+
+/* pigpio backend - pigpio's own functions already have the right signatures */
+struct hal_backend hal_pigpio = {
+	"pigpio",
+	i2cOpen,
+	i2cClose,
+	i2cWriteByte,
+	i2cWriteByteData,
+	i2cWriteWordData,
+	i2cWriteDevice,
+	i2cReadByteData,
+	i2cReadI2CBlockData
+};
+
+/* Backend in use. Switched to hal_sim by hal_init() if impersonate_hw is set */
+struct hal_backend *hal = &hal_pigpio;
+
+/*
+ * Simulated I2C Bus
+ * Each modelled device is identified by its 7-Bit bus address.
+ * The DAC8574 also has two extended address bits (A3, A2) that are
+ * sent in the control byte, so up to 4 DACs can share each bus
+ * address, and they are modelled separately.
+ */
+struct sim_device {
+	int present;
+	int type;					/* DEV_DAC8574, DEV_MCP23008 etc */
+	uint8_t reg[16];			/* MCP23008, SC16IS750 register file. PCF8574 port is reg[0] */
+	uint16_t dac_temp[4][4];	/* DAC8574 temporary registers, per [A3A2][channel] */
+	uint16_t dac_out[4][4];		/* DAC8574 DAC registers, ie what is on the output */
+	uint8_t dac_ext;			/* Bitmap of the [A3A2] extended addresses that are fitted */
+	uint8_t rx_fifo[64];		/* SC16IS750 receive FIFO */
+	int rx_count;
+	uint8_t dll;				/* SC16IS750 Divisor Latch */
+	uint8_t dlh;
+	uint32_t tx_count;			/* Bytes written to the SC16IS750 THR */
+};
+static struct sim_device sim_bus[128];
+static int sim_handle_addr[I2C_MAX_HANDLES];	/* Address each handle is open on, -1 = free */
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sim_midi_thread;
+
+/*
+ * SIM_TRANSFER
+ * Models the time taken by a transfer of the passed number of
+ * bytes (not counting the address byte) on a 400kHz bus: 9 clocks
+ * per byte including the ACK, plus the address byte and a couple
+ * of bit times for the Start and Stop conditions.
+ */
+static void sim_transfer(unsigned bytes)
+{
+	struct timespec ts;
+	uint32_t ns = (((bytes + 1) * 9) + 2) * 2500;
+	ts.tv_sec = 0;
+	ts.tv_nsec = ns;
+	nanosleep(&ts, NULL);
+}
+
+/* Finds the device a handle refers to, or NULL if there isn't one at that address */
+static struct sim_device *sim_lookup(unsigned handle)
+{
+	if((handle >= I2C_MAX_HANDLES) || (sim_handle_addr[handle] < 0)) return NULL;
+	if(!sim_bus[sim_handle_addr[handle]].present) return NULL;
+	return &sim_bus[sim_handle_addr[handle]];
+}
+
+/* DAC8574 - handles one [ctrl][MSB][LSB] triplet */
+static void sim_dac_write(struct sim_device *dev, uint8_t ctrl, uint16_t value)
+{
+	int ext = (ctrl >> 6) & 0x03;
+	int load = (ctrl >> 4) & 0x03;
+	int channel = (ctrl >> 1) & 0x03;
+	int i;
+	// The DAC only responds if the extended address bits match its A3, A2 pins
+	if(!(dev->dac_ext & (0x01 << ext))) return;
+	dev->dac_temp[ext][channel] = value;
+	switch(load){
+		case 0:		/* Store only */
+		break;
+		case 1:		/* Load the selected channel */
+			dev->dac_out[ext][channel] = value;
+		break;
+		case 2:		/* Load all channels */
+		case 3:		/* Broadcast - only one DAC per extended address here, so the same thing */
+			for(i = 0; i < 4; i++) dev->dac_out[ext][i] = dev->dac_temp[ext][i];
+		break;
+	}
+}
+
+/* Register write to an MCP23008 or SC16IS750 */
+static void sim_reg_write(struct sim_device *dev, unsigned reg, unsigned value)
+{
+	if(dev->type == DEV_MCP23008){
+		if(reg > 0x0A) return;
+		// Writing GPIO actually writes the Output Latch
+		if(reg == 0x09) reg = 0x0A;
+		dev->reg[reg] = value;
+	}
+	else if(dev->type == DEV_SC16IS750){
+		reg = (reg >> 3) & 0x0F;
+		// With the Divisor Latch enabled, registers 0 & 1 are DLL & DLH
+		if((reg <= 1) && (dev->reg[3] & 0x80)){
+			if(reg == 0) dev->dll = value; else dev->dlh = value;
+			return;
+		}
+		if(reg == 0){
+			dev->tx_count++;	/* THR - modelled as being sent instantly */
+			return;
+		}
+		// Leave RXLVL / TXLVL / LSR alone, they're read only
+		if((reg == 5) || (reg == 8) || (reg == 9)) return;
+		dev->reg[reg] = value;
+	}
+}
+
+static int sim_open(unsigned bus, unsigned addr, unsigned flags)
+{
+	int handle;
+	pthread_mutex_lock(&sim_lock);
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		if(sim_handle_addr[handle] < 0){
+			// Like the real thing, opening a handle always works whether
+			// or not there's anything on the address
+			sim_handle_addr[handle] = addr & 0x7F;
+			pthread_mutex_unlock(&sim_lock);
+			return handle;
+		}
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return PI_BAD_HANDLE;
+}
+
+static int sim_close(unsigned handle)
+{
+	if(handle >= I2C_MAX_HANDLES) return PI_BAD_HANDLE;
+	sim_handle_addr[handle] = -1;
+	return 0;
+}
+
+static int sim_write_byte(unsigned handle, unsigned value)
+{
+	struct sim_device *dev;
+	int retval = 0;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if(dev == NULL) retval = PI_I2C_WRITE_FAILED;
+	else if(dev->type == DEV_PCF8574) dev->reg[0] = value;
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(1);
+	return retval;
+}
+
+static int sim_write_byte_data(unsigned handle, unsigned reg, unsigned value)
+{
+	struct sim_device *dev;
+	int retval = 0;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if(dev == NULL) retval = PI_I2C_WRITE_FAILED;
+	else sim_reg_write(dev, reg, value & 0xFF);
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(2);
+	return retval;
+}
+
+static int sim_write_word_data(unsigned handle, unsigned reg, unsigned value)
+{
+	struct sim_device *dev;
+	int retval = 0;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if(dev == NULL) retval = PI_I2C_WRITE_FAILED;
+	else if(dev->type == DEV_DAC8574){
+		// Word goes out LSB first, which the caller has already swapped to be the DAC's MSB
+		sim_dac_write(dev, reg, ((value & 0xFF) << 8) | ((value >> 8) & 0xFF));
+	}
+	else {
+		// Sequential register writes
+		sim_reg_write(dev, reg, value & 0xFF);
+		sim_reg_write(dev, reg + ((dev->type == DEV_SC16IS750) ? 8 : 1), (value >> 8) & 0xFF);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(3);
+	return retval;
+}
+
+static int sim_write_device(unsigned handle, char *buf, unsigned count)
+{
+	struct sim_device *dev;
+	int retval = 0;
+	unsigned i;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if(dev == NULL) retval = PI_I2C_WRITE_FAILED;
+	else if(dev->type == DEV_DAC8574){
+		for(i = 0; (i + 3) <= count; i += 3){
+			sim_dac_write(dev, (uint8_t)buf[i], ((uint8_t)buf[i + 1] << 8) | (uint8_t)buf[i + 2]);
+		}
+	}
+	else if(dev->type == DEV_PCF8574){
+		if(count > 0) dev->reg[0] = buf[count - 1];
+	}
+	else if(count > 1){
+		// Register address followed by data
+		for(i = 1; i < count; i++) sim_reg_write(dev, (uint8_t)buf[0], (uint8_t)buf[i]);
+	}
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(count);
+	return retval;
+}
+
+static int sim_read_byte_data(unsigned handle, unsigned reg)
+{
+	struct sim_device *dev;
+	int retval = PI_I2C_READ_FAILED;
+	int i;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if(dev != NULL){
+		if(dev->type == DEV_MCP23008){
+			// All pins are outputs, so GPIO reads back the Output Latch
+			if(reg == 0x09) reg = 0x0A;
+			retval = (reg <= 0x0A) ? dev->reg[reg] : 0;
+		}
+		else if(dev->type == DEV_SC16IS750){
+			reg = (reg >> 3) & 0x0F;
+			switch(reg){
+				case 0:		/* RHR */
+					retval = 0;
+					if(dev->rx_count > 0){
+						retval = dev->rx_fifo[0];
+						dev->rx_count--;
+						for(i = 0; i < dev->rx_count; i++) dev->rx_fifo[i] = dev->rx_fifo[i + 1];
+					}
+				break;
+				case 5:		/* LSR - THR empty, plus data ready if there's anything in the RX FIFO */
+					retval = 0x60 | ((dev->rx_count > 0) ? 0x01 : 0x00);
+				break;
+				case 8:		/* TXLVL - TX FIFO always empty */
+					retval = 64;
+				break;
+				case 9:		/* RXLVL */
+					retval = dev->rx_count;
+				break;
+				default:
+					retval = dev->reg[reg];
+				break;
+			}
+		}
+		else {
+			retval = dev->reg[0];
+		}
+	}
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(2);
+	return retval;
+}
+
+/*
+ * Block reads are only used to drain the SC16IS750 RX FIFO, which,
+ * like the real thing, keeps handing out the next byte from RHR
+ * for as long as the read goes on
+ */
+static int sim_read_block_data(unsigned handle, unsigned reg, char *buf, unsigned count)
+{
+	struct sim_device *dev;
+	int retval = PI_I2C_READ_FAILED;
+	int i;
+	pthread_mutex_lock(&sim_lock);
+	dev = sim_lookup(handle);
+	if((dev != NULL) && (dev->type == DEV_SC16IS750) && (((reg >> 3) & 0x0F) == 0)){
+		if(count > (unsigned)dev->rx_count) count = dev->rx_count;
+		memcpy(buf, dev->rx_fifo, count);
+		dev->rx_count -= count;
+		for(i = 0; i < dev->rx_count; i++) dev->rx_fifo[i] = dev->rx_fifo[i + count];
+		retval = count;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	sim_transfer(count + 1);
+	return retval;
+}
+
+struct hal_backend hal_sim = {
+	"simulated",
+	sim_open,
+	sim_close,
+	sim_write_byte,
+	sim_write_byte_data,
+	sim_write_word_data,
+	sim_write_device,
+	sim_read_byte_data,
+	sim_read_block_data
+};
+
+/* Adds a device to the simulated bus */
+static void sim_add(unsigned addr, int type)
+{
+	sim_bus[addr].present = TRUE;
+	sim_bus[addr].type = type;
+}
+
+/*
+ * SIM_MIDI_RX
+ * Pushes a byte into the receive FIFO of the simulated MIDI
+ * Minion on the passed address, as though it had arrived on
+ * its MIDI In socket. Returns FALSE if the FIFO is full
+ */
+static int sim_midi_rx(unsigned addr, uint8_t byte)
+{
+	struct sim_device *dev = &sim_bus[addr & 0x7F];
+	int ok = FALSE;
+	pthread_mutex_lock(&sim_lock);
+	if(dev->present && (dev->type == DEV_SC16IS750) && (dev->rx_count < 64)){
+		dev->rx_fifo[dev->rx_count++] = byte;
+		ok = TRUE;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return ok;
+}
+
+/*
+ * SIM_MIDI_FEEDER
+ * Detached thread that reads raw MIDI bytes from the SIM_MIDI_FIFO
+ * named pipe and feeds them to the MIDI Minion on the passed
+ * address, at no more than the 31250 baud the real socket runs at.
+ * Re-opens the pipe each time the writer closes it
+ */
+static void *sim_midi_feeder(void *arg)
+{
+	unsigned addr = (unsigned)(uintptr_t)arg;
+	uint8_t buf[64];
+	int fd;
+	int count;
+	int i;
+	while(!ThreadEnd){
+		fd = open(SIM_MIDI_FIFO, O_RDONLY);
+		if(fd < 0){
+			log_msg("Simulated MIDI In: can't open %s\n", SIM_MIDI_FIFO);
+			break;
+		}
+		while(!ThreadEnd && ((count = read(fd, buf, sizeof(buf))) > 0)){
+			for(i = 0; i < count; i++){
+				// Wait for the MIDI thread to empty the FIFO, rather than drop bytes
+				while(!ThreadEnd && (sim_midi_rx(addr, buf[i]) == FALSE)) usleep(1000);
+				usleep(320);	// 10 bits at 31250 baud
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+/*
+ * HAL_INIT
+ * Selects the backend. If we're impersonating the hardware,
+ * then the simulated bus is populated with a Europi, SIM_MINIONS
+ * Minions and SIM_MIDI_MINIONS MIDI Minions, which the normal
+ * hardware scan will then find.
+ */
+void hal_init(void)
+{
+	int i;
+	unsigned addr;
+	for(i = 0; i < I2C_MAX_HANDLES; i++) sim_handle_addr[i] = -1;
+	if(impersonate_hw == FALSE){
+		hal = &hal_pigpio;
+		return;
+	}
+	memset(sim_bus, 0, sizeof(sim_bus));
+	// Europi: PCF8574, plus a DAC8574 on 0x4C with A3,A2 = 1,0
+	sim_add(PCF_BASE_ADDR, DEV_PCF8574);
+	sim_add(DAC_BASE_ADDR, DEV_DAC8574);
+	sim_bus[DAC_BASE_ADDR].dac_ext |= 0x01 << 2;
+	// Minions: MCP23008 on 0x20 + n, DAC8574 on 0x4C + (n & 3) with A3,A2 = n >> 2
+	for(i = 0; i < SIM_MINIONS; i++){
+		sim_add(MCP_BASE_ADDR | i, DEV_MCP23008);
+		addr = DAC_BASE_ADDR | (i & 0x3);
+		sim_add(addr, DEV_DAC8574);
+		sim_bus[addr].dac_ext |= 0x01 << ((i & 0xC) >> 2);
+	}
+	// MIDI Minions, on the addresses hardware_init() scans
+	for(i = 0; i < SIM_MIDI_MINIONS; i++){
+		addr = (i & 0x02) ? (0x54 | (i & 0x01)) : (0x50 | (i & 0x01));
+		sim_add(addr, DEV_SC16IS750);
+	}
+	hal = &hal_sim;
+	log_msg("Using %s I2C backend: Europi, %d Minions, %d MIDI Minions\n", hal->name, SIM_MINIONS, SIM_MIDI_MINIONS);
+	// MIDI In for the first MIDI Minion
+	if(SIM_MIDI_MINIONS > 0){
+		if((mkfifo(SIM_MIDI_FIFO, 0666) != 0) && (errno != EEXIST)){
+			log_msg("Simulated MIDI In: can't create %s\n", SIM_MIDI_FIFO);
+		}
+		else if(pthread_create(&sim_midi_thread, NULL, sim_midi_feeder, (void *)(uintptr_t)0x50) != 0){
+			log_msg("Simulated MIDI In: can't create feeder thread\n");
+		}
+		else pthread_detach(sim_midi_thread);
+	}
+}
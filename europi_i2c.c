@@ -0,0 +1,568 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * I2C Bus Worker
+ *
+ * All run-time writes to the I2C bus (Gates, CVs, MIDI etc) are
+ * posted as requests to a single Bus thread, rather than each
+ * thread calling pigpio directly. Requests go into one of several
+ * priority lanes, each of which is a bounded, lock-free, multi-
+ * producer / single-consumer queue, and the Bus thread always
+ * serves the highest priority lane that has anything waiting.
+ * Synchronous reads (eg polling the MIDI UART) take the same bus
+ * lock the Bus thread holds while it is writing, so nothing ever
+ * talks over anything else.
+ *
+ * A request can carry a done() callback, which is called exactly
+ * once - after the write, with whether the HAL said it worked, or
+ * straight away if the request had to be dropped. The output caches
+ * use it to only record a value once the device has really got it.
+ * It may be called on any thread, so mustn't take a lock that a
+ * producer could be holding while it queues a request.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <pigpio.h>
+
+#include "europi.h"
+
+extern int ThreadEnd;
+extern uint32_t slew_interval;
+
+pthread_t i2cThreadId;				/* The one-and-only Bus thread */
+int i2cThreadLaunched = FALSE;
+pthread_mutex_t i2c_bus_lock;		/* held for the duration of each bus transaction */
+static sem_t i2c_sem;				/* posted once per queued request */
+static struct i2c_lane i2c_lanes[I2C_LANES];
+static struct i2c_bus_stats i2c_stats;
+static uint8_t i2c_handle_addr[I2C_MAX_HANDLES];	/* Address each handle was opened on, 0 = unknown */
+
+/*
+ * I2C_LANE_INIT
+ * Each cell's sequence number starts off equal to its index,
+ * which marks it as free for the producer that claims that
+ * position.
+ */
+static void i2c_lane_init(struct i2c_lane *lane)
+{
+	uint32_t i;
+	memset(lane, 0, sizeof(struct i2c_lane));
+	for(i = 0; i < I2C_QUEUE_SIZE; i++) lane->cells[i].seq = i;
+}
+
+/*
+ * I2C_ENQUEUE
+ * Bounded MPSC queue push. A producer claims a position by
+ * advancing enqueue_pos with a compare and swap, fills the
+ * cell, then publishes it by bumping the cell's sequence
+ * number. Returns -1 if the lane is full.
+ */
+static int i2c_enqueue(struct i2c_lane *lane, struct i2c_req *req)
+{
+	struct i2c_cell *cell;
+	uint32_t pos = lane->enqueue_pos;
+	int32_t dif;
+	while(1){
+		cell = &lane->cells[pos & (I2C_QUEUE_SIZE - 1)];
+		dif = (int32_t)(cell->seq - pos);
+		if(dif == 0){
+			if(__sync_bool_compare_and_swap(&lane->enqueue_pos, pos, pos + 1)) break;
+			pos = lane->enqueue_pos;
+		}
+		else if(dif < 0){
+			return -1;
+		}
+		else {
+			pos = lane->enqueue_pos;
+		}
+	}
+	cell->req = *req;
+	__sync_synchronize();
+	cell->seq = pos + 1;
+	return 0;
+}
+
+/*
+ * I2C_DEQUEUE
+ * Single consumer pop - only ever called from the Bus thread.
+ * Returns -1 if there is nothing (fully published) waiting.
+ */
+static int i2c_dequeue(struct i2c_lane *lane, struct i2c_req *req)
+{
+	struct i2c_cell *cell = &lane->cells[lane->dequeue_pos & (I2C_QUEUE_SIZE - 1)];
+	if((int32_t)(cell->seq - (lane->dequeue_pos + 1)) < 0) return -1;
+	*req = cell->req;
+	__sync_synchronize();
+	cell->seq = lane->dequeue_pos + I2C_QUEUE_SIZE;
+	lane->dequeue_pos++;
+	return 0;
+}
+
+/*
+ * I2C_WIRE_NS
+ * Estimated time a write of the passed number of bytes (not
+ * counting the address) holds the bus: a start, the address,
+ * each byte plus its ACK, and a stop.
+ */
+static uint32_t i2c_wire_ns(unsigned bytes)
+{
+	return (((bytes + 1) * 9) + 2) * I2C_BUS_BIT_NS;
+}
+
+/*
+ * I2C_ACCOUNT
+ * Adds a transaction to the telemetry for the device the
+ * handle is open on - caller must hold i2c_bus_lock
+ */
+static void i2c_account(unsigned handle, unsigned bytes, uint32_t wire_ns, uint32_t busy_us)
+{
+	struct i2c_dev_stats *dev;
+	dev = &i2c_stats.dev[(handle < I2C_MAX_HANDLES) ? i2c_handle_addr[handle] : 0];
+	dev->transactions++;
+	dev->bytes += bytes;
+	dev->wire_ns += wire_ns;
+	i2c_stats.wire_ns += wire_ns;
+	i2c_stats.busy_us += busy_us;
+}
+
+/*
+ * Performs a single request on the bus - caller must hold i2c_bus_lock.
+ * Returns how long it took, in uS. *ok is set to whether the write
+ * worked, for the request's done() callback
+ */
+static uint32_t i2c_execute(struct i2c_req *req, int *ok)
+{
+	uint32_t busy;
+	uint32_t start = sched_tick();
+	unsigned bytes = 0;
+	int retval = -1;
+	switch(req->op){
+		case I2C_OP_BYTE:
+			retval = hal->write_byte(req->handle, (uint8_t)req->data[0]);
+			bytes = 1;
+		break;
+		case I2C_OP_BYTE_DATA:
+			retval = hal->write_byte_data(req->handle, req->reg, (uint8_t)req->data[0]);
+			bytes = 2;
+		break;
+		case I2C_OP_WORD_DATA:
+			retval = hal->write_word_data(req->handle, req->reg, ((uint8_t)req->data[1] << 8) | (uint8_t)req->data[0]);
+			bytes = 3;
+		break;
+		case I2C_OP_DEVICE:
+			retval = hal->write_device(req->handle, req->data, req->len);
+			bytes = req->len;
+		break;
+	}
+	busy = sched_tick() - start;
+	i2c_account(req->handle, bytes, i2c_wire_ns(bytes), busy);
+	*ok = (retval >= 0) ? TRUE : FALSE;
+	return busy;
+}
+
+/*
+ * I2C_SUBMIT
+ * Queues a request on the passed lane and wakes the Bus thread.
+ * If the Bus thread isn't running (eg during start up or shut
+ * down) the request is just carried out there and then. Returns
+ * -1 if the lane is full and the request has been dropped - the
+ * caller can no longer assume the device holds what it sent.
+ */
+static int i2c_submit(int lane, struct i2c_req *req)
+{
+	struct i2c_lane *pLane = &i2c_lanes[lane];
+	uint32_t depth;
+	int ok;
+	if(i2cThreadLaunched == FALSE){
+		pthread_mutex_lock(&i2c_bus_lock);
+		i2c_execute(req, &ok);
+		pthread_mutex_unlock(&i2c_bus_lock);
+		if(req->done != NULL) req->done(req, ok);
+		return 0;
+	}
+	req->queued = sched_tick();
+	if(i2c_enqueue(pLane, req) < 0){
+		// Only log the first one, otherwise the log will be swamped
+		if(__sync_fetch_and_add(&pLane->overflows, 1) == 0) log_msg("I2C lane %d full\n", lane);
+		if(req->done != NULL) req->done(req, FALSE);
+		return -1;
+	}
+	depth = pLane->enqueue_pos - pLane->dequeue_pos;
+	if(depth > pLane->depth_max) pLane->depth_max = depth;
+	sem_post(&i2c_sem);
+	return 0;
+}
+
+int i2c_write_byte(int lane, unsigned handle, uint8_t value, void (*done)(const struct i2c_req *, int))
+{
+	struct i2c_req req;
+	req.op = I2C_OP_BYTE;
+	req.handle = handle;
+	req.done = done;
+	req.data[0] = value;
+	req.len = 1;
+	return i2c_submit(lane, &req);
+}
+
+int i2c_write_byte_data(int lane, unsigned handle, uint8_t reg, uint8_t value, void (*done)(const struct i2c_req *, int))
+{
+	struct i2c_req req;
+	req.op = I2C_OP_BYTE_DATA;
+	req.handle = handle;
+	req.done = done;
+	req.reg = reg;
+	req.data[0] = value;
+	req.len = 1;
+	return i2c_submit(lane, &req);
+}
+
+int i2c_write_word_data(int lane, unsigned handle, uint8_t reg, uint16_t value, void (*done)(const struct i2c_req *, int))
+{
+	struct i2c_req req;
+	req.op = I2C_OP_WORD_DATA;
+	req.handle = handle;
+	req.done = done;
+	req.reg = reg;
+	req.data[0] = value & 0xFF;
+	req.data[1] = (value >> 8) & 0xFF;
+	req.len = 2;
+	return i2c_submit(lane, &req);
+}
+
+int i2c_write_device(int lane, unsigned handle, char *buf, unsigned count, void (*done)(const struct i2c_req *, int))
+{
+	struct i2c_req req;
+	if(count > I2C_MAX_REQ_BYTES) count = I2C_MAX_REQ_BYTES;
+	req.op = I2C_OP_DEVICE;
+	req.handle = handle;
+	req.done = done;
+	memcpy(req.data, buf, count);
+	req.len = count;
+	return i2c_submit(lane, &req);
+}
+
+/*
+ * I2C_READ_BYTE_DATA
+ * Reads are synchronous, as the caller needs the answer, but
+ * still go through the bus lock so they can't collide with
+ * whatever the Bus thread is doing.
+ */
+int i2c_read_byte_data(unsigned handle, uint8_t reg)
+{
+	int retval;
+	uint32_t start;
+	pthread_mutex_lock(&i2c_bus_lock);
+	start = sched_tick();
+	retval = hal->read_byte_data(handle, reg);
+	// Register write, then a repeated start to read the byte back
+	i2c_account(handle, 2, i2c_wire_ns(1) * 2, sched_tick() - start);
+	pthread_mutex_unlock(&i2c_bus_lock);
+	return retval;
+}
+
+/*
+ * I2C_READ_BLOCK_DATA
+ * Synchronous block read of up to 32 bytes starting at the passed
+ * register. Returns the number of bytes read, or < 0 on failure
+ */
+int i2c_read_block_data(unsigned handle, uint8_t reg, char *buf, unsigned count)
+{
+	int retval;
+	uint32_t start;
+	pthread_mutex_lock(&i2c_bus_lock);
+	start = sched_tick();
+	retval = hal->read_block_data(handle, reg, buf, count);
+	i2c_account(handle, (retval > 0) ? retval + 1 : 1, i2c_wire_ns(1) + i2c_wire_ns((retval > 0) ? retval : 0), sched_tick() - start);
+	pthread_mutex_unlock(&i2c_bus_lock);
+	return retval;
+}
+
+/*
+ * I2C Bus Thread - Joinable thread that lives for the
+ * whole time the prog is running. Each pass it takes
+ * one request from the highest priority lane that has
+ * one waiting, so a burst of slew points can never hold
+ * up a Gate for more than a single transaction. Step CVs
+ * share the slew points' lane, so a DAC always ends up
+ * on whichever value was sent to it last.
+ */
+void *I2cThread(void *arg)
+{
+	struct i2c_req req;
+	struct timespec ts;
+	uint32_t latency;
+	int lane;
+	int bucket;
+	int ok;
+	while(!ThreadEnd){
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 10000000;		// Wake up every 10ms anyway so ThreadEnd is noticed
+		if(ts.tv_nsec >= 1000000000){
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+		if(sem_timedwait(&i2c_sem, &ts) != 0) continue;
+		for(lane = 0; lane < I2C_LANES; lane++){
+			if(i2c_dequeue(&i2c_lanes[lane], &req) == 0) break;
+		}
+		if(lane >= I2C_LANES){
+			// A producer has claimed a cell but not published it yet, so
+			// put the wake-up back and give it a moment to finish
+			sem_post(&i2c_sem);
+			usleep(10);
+			continue;
+		}
+		pthread_mutex_lock(&i2c_bus_lock);
+		i2c_lanes[lane].busy_us += i2c_execute(&req, &ok);
+		pthread_mutex_unlock(&i2c_bus_lock);
+		if(req.done != NULL) req.done(&req, ok);
+		latency = sched_tick() - req.queued;
+		i2c_lanes[lane].count++;
+		i2c_lanes[lane].latency_total += latency;
+		if(latency > i2c_lanes[lane].latency_max) i2c_lanes[lane].latency_max = latency;
+		for(bucket = 0; bucket < (I2C_HIST_BUCKETS - 1); bucket++){
+			if(latency < (I2C_HIST_BASE_US << bucket)) break;
+		}
+		i2c_stats.latency_hist[bucket]++;
+	}
+	return NULL;
+}
+
+/*
+ * I2C_START
+ * Initialises the lanes and launches the Bus thread. Called
+ * once from startup(), before the hardware is scanned
+ */
+void i2c_start(void)
+{
+	struct sched_param param;
+	int lane;
+	for(lane = 0; lane < I2C_LANES; lane++) i2c_lane_init(&i2c_lanes[lane]);
+	if (pthread_mutex_init(&i2c_bus_lock, NULL) != 0){
+		log_msg("I2C Bus mutex init failed\n");
+	}
+	sem_init(&i2c_sem, 0, 0);
+	i2c_stats.sample_tick = sched_tick();
+	if(pthread_create(&i2cThreadId, NULL, I2cThread, NULL) != 0){
+		log_msg("Error creating I2C Bus thread\n");
+		return;
+	}
+	i2cThreadLaunched = TRUE;
+	// The Bus thread sits just below the Scheduler
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 15;
+	if(pthread_setschedparam(i2cThreadId, SCHED_FIFO, &param) != 0){
+		log_msg("I2C Bus running without RT priority\n");
+	}
+}
+
+/*
+ * I2C_STOP
+ * Waits for the Bus thread to finish, logs the queue stats,
+ * and carries out anything that was still waiting so that
+ * the final state of the outputs actually gets written.
+ */
+void i2c_stop(void)
+{
+	struct i2c_req req;
+	int lane;
+	int ok;
+	if(i2cThreadLaunched == TRUE){
+		pthread_join(i2cThreadId, NULL);
+		i2cThreadLaunched = FALSE;
+	}
+	for(lane = 0; lane < I2C_LANES; lane++){
+		while(i2c_dequeue(&i2c_lanes[lane], &req) == 0){
+			i2c_execute(&req, &ok);
+			if(req.done != NULL) req.done(&req, ok);
+		}
+		if(i2c_lanes[lane].count > 0){
+			log_msg("I2C lane %d: %u writes, max depth %u, avg latency %uus, max latency %uus, overflows %u\n",
+				lane, i2c_lanes[lane].count, i2c_lanes[lane].depth_max,
+				(unsigned)(i2c_lanes[lane].latency_total / i2c_lanes[lane].count),
+				i2c_lanes[lane].latency_max, i2c_lanes[lane].overflows);
+		}
+	}
+	sem_destroy(&i2c_sem);
+}
+
+/*
+ * I2C_OPEN
+ * Opens a device through the HAL, and remembers which address
+ * the handle belongs to so its traffic can be accounted for
+ */
+int i2c_open(unsigned bus, unsigned addr, unsigned flags)
+{
+	int handle = hal->open(bus, addr, flags);
+	if((handle >= 0) && (handle < I2C_MAX_HANDLES)) i2c_handle_addr[handle] = addr & 0x7F;
+	return handle;
+}
+
+/*
+ * I2C_STATS_SAMPLE
+ * Works out the per-device and whole bus rates, if at least
+ * I2C_STATS_PERIOD has gone by since they were last worked
+ * out, and returns the stats. Cheap enough to call every frame
+ */
+struct i2c_bus_stats *i2c_stats_sample(void)
+{
+	struct i2c_dev_stats *dev;
+	uint32_t now;
+	uint32_t elapsed;
+	uint32_t transactions = 0;
+	uint32_t bytes = 0;
+	int addr;
+	pthread_mutex_lock(&i2c_bus_lock);
+	now = sched_tick();
+	elapsed = now - i2c_stats.sample_tick;
+	if(elapsed >= I2C_STATS_PERIOD){
+		for(addr = 0; addr < 128; addr++){
+			dev = &i2c_stats.dev[addr];
+			dev->tx_rate = (uint32_t)(((uint64_t)(dev->transactions - dev->last_transactions) * 1000000) / elapsed);
+			dev->byte_rate = (uint32_t)(((uint64_t)(dev->bytes - dev->last_bytes) * 1000000) / elapsed);
+			transactions += dev->transactions - dev->last_transactions;
+			bytes += dev->bytes - dev->last_bytes;
+			dev->last_transactions = dev->transactions;
+			dev->last_bytes = dev->bytes;
+		}
+		i2c_stats.tx_rate = (uint32_t)(((uint64_t)transactions * 1000000) / elapsed);
+		i2c_stats.byte_rate = (uint32_t)(((uint64_t)bytes * 1000000) / elapsed);
+		i2c_stats.busy_permille = (uint32_t)(((i2c_stats.busy_us - i2c_stats.last_busy_us) * 1000) / elapsed);
+		// nS in uS of sample is already parts per thousand
+		i2c_stats.wire_permille = (uint32_t)((i2c_stats.wire_ns - i2c_stats.last_wire_ns) / elapsed);
+		i2c_stats.last_busy_us = i2c_stats.busy_us;
+		i2c_stats.last_wire_ns = i2c_stats.wire_ns;
+		i2c_stats.sample_tick = now;
+	}
+	pthread_mutex_unlock(&i2c_bus_lock);
+	return &i2c_stats;
+}
+
+/*
+ * I2C_STATS_DUMP
+ * Writes the bus telemetry out as CSV. The first column of
+ * each row says what sort of record it is, so it can be split
+ * up with grep or read straight into a spreadsheet
+ */
+int i2c_stats_dump(const char *path)
+{
+	struct i2c_bus_stats *stats = i2c_stats_sample();
+	struct i2c_lane *lane;
+	FILE *file;
+	int addr;
+	int i;
+	file = fopen(path, "w");
+	if(file == NULL){
+		log_msg("Unable to write %s\n", path);
+		return -1;
+	}
+	fprintf(file, "bus,tx_per_sec,bytes_per_sec,busy_permille,wire_permille,busy_us,wire_us\n");
+	fprintf(file, "bus,%u,%u,%u,%u,%llu,%llu\n", stats->tx_rate, stats->byte_rate,
+		stats->busy_permille, stats->wire_permille,
+		(unsigned long long)stats->busy_us, (unsigned long long)(stats->wire_ns / 1000));
+	fprintf(file, "device,address,transactions,bytes,tx_per_sec,bytes_per_sec,wire_us\n");
+	for(addr = 0; addr < 128; addr++){
+		if(stats->dev[addr].transactions == 0) continue;
+		fprintf(file, "device,0x%02X,%u,%u,%u,%u,%llu\n", addr,
+			stats->dev[addr].transactions, stats->dev[addr].bytes,
+			stats->dev[addr].tx_rate, stats->dev[addr].byte_rate,
+			(unsigned long long)(stats->dev[addr].wire_ns / 1000));
+	}
+	fprintf(file, "latency,below_us,writes\n");
+	for(i = 0; i < I2C_HIST_BUCKETS; i++){
+		// The last bucket catches everything slower
+		if(i < (I2C_HIST_BUCKETS - 1)) fprintf(file, "latency,%u,%u\n", I2C_HIST_BASE_US << i, stats->latency_hist[i]);
+		else fprintf(file, "latency,inf,%u\n", stats->latency_hist[i]);
+	}
+	fprintf(file, "lane,lane,writes,max_depth,avg_latency_us,max_latency_us,overflows\n");
+	for(i = 0; i < I2C_LANES; i++){
+		lane = &i2c_lanes[i];
+		fprintf(file, "lane,%d,%u,%u,%u,%u,%u\n", i, lane->count, lane->depth_max,
+			(lane->count > 0) ? (unsigned)(lane->latency_total / lane->count) : 0,
+			lane->latency_max, lane->overflows);
+	}
+	fprintf(file, "ramps,active,interval_us\n");
+	fprintf(file, "ramps,%d,%u\n", sched_ramps_active(), slew_interval);
+	fclose(file);
+	return 0;
+}
+
+/*
+ * I2C_RAMP_INTERVAL
+ * The ramp rate governor. Measures what one DAC lane write has
+ * been costing, and how much of the bus everything else (Gates,
+ * MIDI, polling) has been using since the last call, then
+ * spreads what is left between the passed number of running
+ * ramps. Returns the interval between ramp points that fits, so
+ * ramps get finer when the bus is quiet and coarser (rather than
+ * late) when it's busy. Only ever called from the Scheduler thread
+ */
+uint32_t i2c_ramp_interval(int active)
+{
+	static uint32_t last_tick = 0;
+	static uint32_t last_count = 0;
+	static uint64_t last_slew_us = 0;
+	static uint64_t last_total_us = 0;
+	static uint32_t cost = 0;
+	struct i2c_lane *pLane = &i2c_lanes[I2C_LANE_CV];
+	uint32_t now;
+	uint32_t elapsed;
+	uint32_t count;
+	uint64_t slew_us;				/* DAC lane time - mostly, but not only, ramp points */
+	uint64_t other_us;
+	uint32_t budget;
+	uint64_t interval;
+	// Until anything's been measured, assume a single DAC channel write
+	if(cost == 0) cost = (i2c_wire_ns(3) + 999) / 1000;
+	pthread_mutex_lock(&i2c_bus_lock);
+	now = sched_tick();
+	elapsed = now - last_tick;
+	count = pLane->count - last_count;
+	slew_us = pLane->busy_us - last_slew_us;
+	other_us = (i2c_stats.busy_us - last_total_us) - slew_us;
+	last_tick = now;
+	last_count = pLane->count;
+	last_slew_us = pLane->busy_us;
+	last_total_us = i2c_stats.busy_us;
+	pthread_mutex_unlock(&i2c_bus_lock);
+	// Smooth the cost a bit, so one slow write doesn't make everything jump
+	if(count > 0) cost = ((cost * 3) + (uint32_t)(slew_us / count) + 3) / 4;
+	if(cost == 0) cost = 1;
+	if(active <= 0) return SLEW_INTERVAL_MIN;
+	if(elapsed == 0) elapsed = 1;
+	if((other_us * 1000) / elapsed >= (RAMP_BUDGET - RAMP_BUDGET_MIN)) budget = RAMP_BUDGET_MIN;
+	else budget = RAMP_BUDGET - (uint32_t)((other_us * 1000) / elapsed);
+	interval = ((uint64_t)cost * active * 1000) / budget;
+	if(interval < SLEW_INTERVAL_MIN) interval = SLEW_INTERVAL_MIN;
+	if(interval > SLEW_INTERVAL_MAX) interval = SLEW_INTERVAL_MAX;
+	return (uint32_t)interval;
+}
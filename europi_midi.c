@@ -0,0 +1,616 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+/*
+ * MIDI Input
+ *
+ * Each MIDI Minion has a Listener thread that drains the SC16IS750's
+ * RX FIFO and feeds the bytes through an incremental MIDI 1.0 parser.
+ * The parser copes with running status, real-time bytes turning up
+ * in the middle of other messages, System Common messages and SysEx,
+ * which is passed on in small chunks and cut off at MIDI_SYSEX_MAX
+ * bytes so a runaway dump can't swamp anything.
+ *
+ * Every decoded message is stamped with the tick it arrived at and
+ * put on its port's queue, which is a lock-free single-producer /
+ * single-consumer ring - the Listener thread is the only producer
+ * and the main loop, via midi_dispatch(), the only consumer. The
+ * exception is Clock, Start, Continue and Stop, which are timing
+ * critical and so are also acted on there and then by the Listener.
+ *
+ * MIDI Output
+ *
+ * Notes for the MIDI Minions are played by Gate events, just like a
+ * Gate output, so they get the same lengths and ratchets. Rather than
+ * writing each byte to the UART separately, messages are staged per
+ * Minion, using running status (and Note On, velocity 0 for Note
+ * Off, so a stream of notes never needs a new Status byte) and
+ * MIDIFlush() then writes the lot to THR in a single transfer.
+
+ * When running from the Internal Clock, MIDI Clock, Start, Stop,
+ * Continue and Song Position are sent to every MIDI Minion, so other
+ * gear can follow the Europi.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <pigpio.h>
+
+#include "europi.h"
+
+extern int ThreadEnd;
+extern int run_stop;
+extern int step_one;
+extern int clock_source;
+extern int midi_clock_counter;
+extern int midi_clock_divisor;
+extern struct europi Europi;
+extern int last_track;
+
+int midi_irq = FALSE;					/* TRUE if the MIDI Minions' IRQ line is wired up */
+uint32_t midi_song_position = 0;		/* Last Song Position Pointer received, in MIDI Beats (16ths) */
+static pthread_mutex_t midi_irq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t midi_irq_cond = PTHREAD_COND_INITIALIZER;
+static volatile uint32_t midi_irq_count = 0;	/* Bumped on every falling edge of the IRQ line */
+static struct midi_queue midi_queues[MIDI_PORTS];
+static pthread_mutex_t midi_tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct midi_tx midi_tx[I2C_MAX_HANDLES];	/* Staged output, per MIDI Minion handle */
+static int midi_clock_state = MIDI_CLOCK_STOPPED;
+
+/*
+ * MIDI_REALTIME
+ * Acts on the real-time messages that drive the sequencer
+ * when it's running from an External Clock. tick is when
+ * the byte was taken from the RX FIFO
+ */
+static void midi_realtime(uint8_t byte, uint32_t tick)
+{
+    /* Only react to MIDI Clock etc if Clock Source is External */
+    if (clock_source != EXT_CLK) return;
+    switch(byte){
+        case Clock:
+            tempo_edge(MIDI_CLK, tick, midi_clock_divisor);
+            if(run_stop == RUN){
+                if(midi_clock_counter++ >= (midi_clock_divisor -1)){
+                    midi_clock_counter = 0;
+                    GATEStage(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,HIGH);
+                    next_step();
+                }
+                if(midi_clock_counter == (midi_clock_divisor / 2)){
+                    GATESingleOutput(Europi.tracks[0].channels[GATE_OUT].i2c_handle,CLOCK_OUT,DEV_PCF8574,LOW);
+                }
+            }
+        break;
+        case Start:
+            /* MIDI Start re-starts the sequence from Step One */
+            run_stop = RUN;
+            step_one = TRUE;
+            midi_clock_counter = 0;
+            next_step();
+        break;
+        case Continue:
+            run_stop = RUN;
+        break;
+        case Stop:
+            run_stop = STOP;
+        break;
+    }
+}
+
+/*
+ * MIDI_QUEUE_PUT
+ * Producer side of a port's event queue - only ever called
+ * from that port's Listener thread. The event is copied in
+ * before head moves on, so the consumer never sees half of one
+ */
+static void midi_queue_put(struct midi_queue *queue, struct midi_event *ev)
+{
+	if((queue->head - queue->tail) >= MIDI_QUEUE_SIZE){
+		// Only log the first one, otherwise the log will be swamped
+		if(queue->overflows++ == 0) log_msg("MIDI In queue full\n");
+		return;
+	}
+	queue->events[queue->head & (MIDI_QUEUE_SIZE - 1)] = *ev;
+	__sync_synchronize();
+	queue->head++;
+}
+
+/*
+ * MIDI_QUEUE_GET
+ * Consumer side - returns -1 if the queue is empty
+ */
+static int midi_queue_get(struct midi_queue *queue, struct midi_event *ev)
+{
+	if(queue->tail == queue->head) return -1;
+	__sync_synchronize();
+	*ev = queue->events[queue->tail & (MIDI_QUEUE_SIZE - 1)];
+	__sync_synchronize();
+	queue->tail++;
+	return 0;
+}
+
+/* Queues a message (or SysEx chunk) of len data bytes */
+static void midi_emit(struct midi_parser *parser, uint8_t status, uint8_t *data, int len, uint8_t flags, uint32_t tick)
+{
+	struct midi_event ev;
+	memset(&ev, 0, sizeof(struct midi_event));
+	ev.tick = tick;
+	ev.port = parser->port;
+	ev.status = status;
+	ev.len = len;
+	ev.flags = flags;
+	if(len > 0) memcpy(ev.data, data, len);
+	// A Note On with zero velocity is really a Note Off
+	if(((status & 0xF0) == NoteOn) && (len == 2) && (ev.data[1] == 0)) ev.status = NoteOff | (status & 0x0F);
+	midi_queue_put(&midi_queues[parser->port], &ev);
+}
+
+/* Passes on whatever SysEx has been gathered, marked with the passed flags */
+static void midi_sysex_flush(struct midi_parser *parser, uint8_t flags, uint32_t tick)
+{
+	if(parser->sysex_total == parser->sysex_count) flags |= MIDI_SYSEX_START;
+	if(parser->sysex_total > MIDI_SYSEX_MAX) flags |= MIDI_SYSEX_TRUNCATED;
+	midi_emit(parser, SystemExclusive, parser->sysex, parser->sysex_count, flags, tick);
+	parser->sysex_count = 0;
+}
+
+/*
+ * MIDI_PARSER_INIT
+ * Resets the parser for the passed port, eg when its Listener starts
+ */
+void midi_parser_init(struct midi_parser *parser, int port)
+{
+	memset(parser, 0, sizeof(struct midi_parser));
+	parser->port = port;
+}
+
+/*
+ * MIDI_PARSE
+ * Feeds one received byte through the parser. Complete messages
+ * are queued for midi_dispatch(), stamped with the passed tick.
+ */
+void midi_parse(struct midi_parser *parser, uint8_t byte, uint32_t tick)
+{
+	if(byte >= 0xF8){
+		// Real-time messages can turn up anywhere, even in the middle
+		// of another message, and don't disturb anything else
+		if((byte == 0xF9) || (byte == 0xFD)) return;	// Undefined
+		midi_realtime(byte, tick);
+		midi_emit(parser, byte, NULL, 0, 0, tick);
+		return;
+	}
+	if(byte & 0x80){
+		// Any other Status byte ends a SysEx, whether it's EOX or not
+		if(parser->in_sysex){
+			parser->in_sysex = FALSE;
+			midi_sysex_flush(parser, MIDI_SYSEX_END, tick);
+		}
+		parser->count = 0;
+		switch(byte){
+			case SystemExclusive:
+				parser->status = 0;
+				parser->in_sysex = TRUE;
+				parser->sysex_count = 0;
+				parser->sysex_total = 0;
+			break;
+			case 0xF7:		// EOX, already dealt with above
+			case 0xF4:		// Undefined
+			case 0xF5:
+				parser->status = 0;
+			break;
+			case TuneRequest:
+				parser->status = 0;
+				midi_emit(parser, byte, NULL, 0, 0, tick);
+			break;
+			case TimeCodeQuarterFrame:
+			case SongSelect:
+				parser->status = byte;
+				parser->needed = 1;
+			break;
+			case SongPosition:
+				parser->status = byte;
+				parser->needed = 2;
+			break;
+			default:
+				// Channel Voice - this becomes the running status
+				parser->status = byte;
+				switch(byte & 0xF0){
+					case ProgramChange:
+					case AfterTouchChannel:
+						parser->needed = 1;
+					break;
+					default:
+						parser->needed = 2;
+					break;
+				}
+			break;
+		}
+		return;
+	}
+	// Data byte
+	if(parser->in_sysex){
+		if(parser->sysex_total++ < MIDI_SYSEX_MAX){
+			parser->sysex[parser->sysex_count++] = byte;
+			if(parser->sysex_count >= MIDI_EVENT_DATA) midi_sysex_flush(parser, 0, tick);
+		}
+		return;
+	}
+	// Data with no status to go with it (eg we came in half way through a message)
+	if(parser->status == 0) return;
+	parser->data[parser->count++] = byte;
+	if(parser->count < parser->needed) return;
+	midi_emit(parser, parser->status, parser->data, parser->needed, 0, tick);
+	parser->count = 0;
+	// System Common messages cancel running status
+	if(parser->status >= 0xF0) parser->status = 0;
+}
+
+/*
+ * MIDI_DISPATCH
+ * Called from the main loop. Takes every event waiting on every
+ * port's queue and acts on the ones the sequencer uses
+ */
+void midi_dispatch(void)
+{
+	struct midi_event ev;
+	int port;
+	for(port = 0; port < MIDI_PORTS; port++){
+		while(midi_queue_get(&midi_queues[port], &ev) == 0){
+			switch(ev.status){
+				case SongPosition:
+					midi_song_position = ev.data[0] | (ev.data[1] << 7);
+				break;
+				default:
+					// Channel Voice, SysEx etc aren't used by anything yet
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * MIDI_INTERRUPT
+ * Callback for the (shared, active low) SC16IS750 IRQ line, if
+ * one is wired. Just wakes every MIDI Listener, each of which
+ * then checks its own RX FIFO
+ */
+void midi_interrupt(int gpio, int level, uint32_t tick)
+{
+    if(level != 0) return;
+    pthread_mutex_lock(&midi_irq_lock);
+    midi_irq_count++;
+    pthread_cond_broadcast(&midi_irq_cond);
+    pthread_mutex_unlock(&midi_irq_lock);
+}
+
+/*
+ * MIDI_WAIT
+ * Sleeps until the IRQ line says there is something to read (or
+ * for timeout uS, whichever comes first) if an IRQ line is wired,
+ * otherwise for the passed poll interval. seen is midi_irq_count
+ * from before the RX FIFO was last found empty, so an interrupt
+ * that came in since then isn't missed
+ */
+static void midi_wait(uint32_t poll_us, uint32_t seen)
+{
+    struct timespec ts;
+    if(midi_irq == FALSE){
+        usleep(poll_us);
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long)MIDI_IRQ_TIMEOUT * 1000;
+    while(ts.tv_nsec >= 1000000000){
+        ts.tv_nsec -= 1000000000;
+        ts.tv_sec++;
+    }
+    pthread_mutex_lock(&midi_irq_lock);
+    while((midi_irq_count == seen) && !ThreadEnd){
+        if(pthread_cond_timedwait(&midi_irq_cond, &midi_irq_lock, &ts) != 0) break;
+    }
+    pthread_mutex_unlock(&midi_irq_lock);
+}
+
+/*
+ * MIDI Thread - Joinable thread launched
+ * for each MIDI Minion (ie up to 4 of these
+ * could be running). Whenever RXLVL says there is
+ * anything in the RX FIFO, the lot is taken in a
+ * single block read and fed through the parser. In
+ * between, it either waits for the IRQ line or, if
+ * there isn't one, polls - quickly while MIDI is
+ * arriving, backing off once it stops
+ */
+void *MidiThread(void *arg)
+{
+    struct midiChnl *pMidiChnl = (struct midiChnl *)arg;
+	int fd = pMidiChnl->i2c_handle;
+    struct midi_parser parser;
+    char buf[MIDI_RX_BURST];
+    int rx_level;
+    int count;
+    int i;
+    uint32_t tick;
+    uint32_t seen;
+    uint32_t poll_us = MIDI_POLL_MIN;
+    uint32_t last_rx = sched_tick();
+    midi_parser_init(&parser, pMidiChnl->port);
+    while (!ThreadEnd){
+        seen = midi_irq_count;
+        rx_level = i2c_read_byte_data(fd,SC16IS750_RXLVL);
+        if(rx_level > 0) {
+            if(rx_level > MIDI_RX_BURST) rx_level = MIDI_RX_BURST;
+            tick = sched_tick();
+            count = i2c_read_block_data(fd,SC16IS750_RHR,buf,rx_level);
+            for(i = 0; i < count; i++) midi_parse(&parser, (uint8_t)buf[i], tick);
+            last_rx = tick;
+            poll_us = MIDI_POLL_MIN;
+            // There may well be more behind it, so go straight round again
+            continue;
+        }
+        midi_wait(poll_us, seen);
+        poll_us *= 2;
+        if((sched_tick() - last_rx) < MIDI_POLL_IDLE_AFTER){
+            if(poll_us > MIDI_POLL_ACTIVE_MAX) poll_us = MIDI_POLL_ACTIVE_MAX;
+        }
+        else if(poll_us > MIDI_POLL_IDLE_MAX) poll_us = MIDI_POLL_IDLE_MAX;
+    }
+    return NULL;
+}
+
+/*
+ * MIDI_TX_WRITE
+ * Writes whatever is staged for the passed handle to its THR, in as
+ * few transfers as the I2C request size allows - caller must hold
+ * midi_tx_lock. The activity LED is lit while any note is sounding.
+ * If the Bus lane is full, whatever didn't fit stays staged for the
+ * next flush, in order, rather than being lost
+ */
+static void midi_tx_write(int lane, unsigned handle)
+{
+	struct midi_tx *tx = &midi_tx[handle];
+	char buf[I2C_MAX_REQ_BYTES];
+	int sent = 0;
+	int len;
+	while(sent < tx->count){
+		len = tx->count - sent;
+		if(len > (I2C_MAX_REQ_BYTES - 1)) len = I2C_MAX_REQ_BYTES - 1;
+		buf[0] = SC16IS750_THR;
+		memcpy(&buf[1], &tx->buf[sent], len);
+		if(i2c_write_device(lane, handle, buf, len + 1, NULL) < 0) break;
+		sent += len;
+	}
+	if(sent > 0) tx->last_sent = sched_tick();
+	if(sent < tx->count){
+		memmove(tx->buf, &tx->buf[sent], tx->count - sent);
+		tx->count -= sent;
+		return;
+	}
+	tx->count = 0;
+	if((tx->notes > 0) != tx->led){
+		// GPIO is active low
+		if(i2c_write_byte_data(lane, handle, SC16IS750_IOSTATE, (tx->notes > 0) ? 0x00 : 0xFF, NULL) == 0) tx->led = (tx->notes > 0);
+	}
+}
+
+/*
+ * MIDI_TX_STAGE
+ * Adds a message to the passed handle's staged output, leaving out
+ * the Status byte if it's the same as the last one sent and the
+ * line hasn't been quiet for too long - caller must hold midi_tx_lock
+ */
+static void midi_tx_stage(unsigned handle, uint8_t status, uint8_t data1, uint8_t data2)
+{
+	struct midi_tx *tx = &midi_tx[handle];
+	// Make room if need be (there won't normally be more than a couple of messages)
+	if((tx->count + 3) > MIDI_TX_BUF) midi_tx_write(I2C_LANE_GATE, handle);
+	// Still no room - the Bus is hopelessly backed up
+	if((tx->count + 3) > MIDI_TX_BUF) return;
+	if((tx->count == 0) && ((sched_tick() - tx->last_sent) >= MIDI_RUNNING_STATUS_TIMEOUT)) tx->running = 0;
+	if(status != tx->running){
+		tx->buf[tx->count++] = status;
+		tx->running = status;
+	}
+	tx->buf[tx->count++] = data1 & 0x7F;
+	tx->buf[tx->count++] = data2 & 0x7F;
+}
+
+/*
+ * MIDINoteOn
+ * Stages a Note On for the passed MIDI Minion and channel. Only one
+ * note sounds per channel, so if the last one is still going (eg a
+ * held Gate) it is turned off first
+ */
+void MIDINoteOn(unsigned handle, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+	struct midi_tx *tx;
+	if(handle >= I2C_MAX_HANDLES) return;
+	tx = &midi_tx[handle];
+	channel &= 0x0F;
+	pthread_mutex_lock(&midi_tx_lock);
+	if(tx->sounding[channel] != 0){
+		midi_tx_stage(handle, NoteOn | channel, tx->sounding[channel] - 1, 0);
+		tx->notes--;
+	}
+	if(velocity == 0) velocity = 1;		// Velocity 0 would be a Note Off
+	midi_tx_stage(handle, NoteOn | channel, note, velocity);
+	tx->sounding[channel] = (note & 0x7F) + 1;
+	tx->notes++;
+	pthread_mutex_unlock(&midi_tx_lock);
+}
+
+/*
+ * MIDINoteOff
+ * Stages a Note Off, but only if the passed note is the one still
+ * sounding on the channel - by the time a note's Off is due it may
+ * already have been cut short by the next one. MIDI_ANY_NOTE turns
+ * off whatever is sounding
+ */
+void MIDINoteOff(unsigned handle, uint8_t channel, uint8_t note)
+{
+	struct midi_tx *tx;
+	if(handle >= I2C_MAX_HANDLES) return;
+	tx = &midi_tx[handle];
+	channel &= 0x0F;
+	pthread_mutex_lock(&midi_tx_lock);
+	if((tx->sounding[channel] != 0) && ((note == MIDI_ANY_NOTE) || (tx->sounding[channel] == (note & 0x7F) + 1))){
+		midi_tx_stage(handle, NoteOn | channel, tx->sounding[channel] - 1, 0);
+		tx->sounding[channel] = 0;
+		tx->notes--;
+	}
+	pthread_mutex_unlock(&midi_tx_lock);
+}
+
+/*
+ * MIDIAllNotesOff
+ * Turns off every note still sounding on every MIDI Minion, and
+ * writes them out straight away. Used when shutting down
+ */
+void MIDIAllNotesOff(void)
+{
+	int handle;
+	int channel;
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		for(channel = 0; channel < 16; channel++){
+			if(midi_tx[handle].sounding[channel] != 0) MIDINoteOff(handle, channel, MIDI_ANY_NOTE);
+		}
+	}
+	MIDIFlush(I2C_LANE_GATE);
+}
+
+/*
+ * MIDIFlush
+ * Writes out everything staged for every MIDI Minion
+ */
+void MIDIFlush(int lane)
+{
+	int handle;
+	pthread_mutex_lock(&midi_tx_lock);
+	for(handle = 0; handle < I2C_MAX_HANDLES; handle++){
+		if((midi_tx[handle].count > 0) || ((midi_tx[handle].notes > 0) != midi_tx[handle].led)) midi_tx_write(lane, handle);
+	}
+	pthread_mutex_unlock(&midi_tx_lock);
+}
+
+/*
+ * MIDI_REALTIME_OUT
+ * Sends a real-time (or short System Common) message to every MIDI
+ * Minion straight away, on the highest priority lane. Real-time
+ * bytes don't affect running status, so they can go out whatever
+ * else has been staged. System Common messages (Song Position)
+ * cancel it, so anything staged goes out first and the next
+ * Channel message is sent with its Status byte
+ */
+static void midi_realtime_out(uint8_t *msg, int len)
+{
+	char buf[4];
+	int track;
+	unsigned handle;
+	buf[0] = SC16IS750_THR;
+	memcpy(&buf[1], msg, len);
+	for(track = 0; track < last_track; track++){
+		if((Europi.tracks[track].channels[CV_OUT].enabled == TRUE) && (Europi.tracks[track].channels[CV_OUT].type == CHNL_TYPE_MIDI)){
+			handle = Europi.tracks[track].channels[CV_OUT].i2c_handle;
+			if(msg[0] >= Clock){
+				i2c_write_device(I2C_LANE_GATE, handle, buf, len + 1, NULL);
+			}
+			else if(handle < I2C_MAX_HANDLES){
+				pthread_mutex_lock(&midi_tx_lock);
+				if(midi_tx[handle].count > 0) midi_tx_write(I2C_LANE_GATE, handle);
+				i2c_write_device(I2C_LANE_GATE, handle, buf, len + 1, NULL);
+				midi_tx[handle].running = 0;
+				pthread_mutex_unlock(&midi_tx_lock);
+			}
+		}
+	}
+}
+
+/*
+ * MIDIClockOut
+ * Called by master_clock() on every tick of the Internal Clock,
+ * after the step counter has been moved on. running says whether
+ * the sequence is running from the Internal Clock, and counter is
+ * the position within the step (0 - 95, a new step starting at 0).
+ * A MIDI Clock goes out every MIDI_CLOCK_TICKS ticks, which lines
+ * up with the steps. Start (or Song Position and Continue) is held
+ * back until one Clock before the next step, so the first Clock the
+ * other gear sees is the start of a step. Start is sent whenever
+ * Track 0 is about to go back to Step 1 (including a Reset while
+ * running), otherwise the Song Position is where Track 0 will carry
+ * on from
+ */
+void MIDIClockOut(int running, int counter)
+{
+	uint8_t msg[3];
+	int position;
+	if(!running){
+		if(midi_clock_state == MIDI_CLOCK_RUNNING){
+			msg[0] = Stop;
+			midi_realtime_out(msg, 1);
+		}
+		midi_clock_state = MIDI_CLOCK_STOPPED;
+		return;
+	}
+	switch(midi_clock_state){
+		case MIDI_CLOCK_STOPPED:
+		case MIDI_CLOCK_PENDING:
+			midi_clock_state = MIDI_CLOCK_PENDING;
+			if(counter != (96 - MIDI_CLOCK_TICKS)) break;
+			position = (step_one == TRUE) ? 0 : playhead_position(0);
+			if(position == 0){
+				msg[0] = Start;
+				midi_realtime_out(msg, 1);
+			}
+			else {
+				// Song Position is in 16ths, ie 6 MIDI Clocks
+				position = (position * (96 / MIDI_CLOCK_TICKS)) / 6;
+				if(position > MIDI_SONG_POSITION_MAX){
+					log_msg("MIDIClockOut: Song Position %d out of range\n", position);
+					position = MIDI_SONG_POSITION_MAX;
+				}
+				msg[0] = SongPosition;
+				msg[1] = position & 0x7F;
+				msg[2] = (position >> 7) & 0x7F;
+				midi_realtime_out(msg, 3);
+				msg[0] = Continue;
+				midi_realtime_out(msg, 1);
+			}
+			midi_clock_state = MIDI_CLOCK_RUNNING;
+		break;
+		case MIDI_CLOCK_RUNNING:
+			if((counter == (96 - MIDI_CLOCK_TICKS)) && (step_one == TRUE)){
+				// Reset while running - the next Clock is the first step again
+				msg[0] = Start;
+				midi_realtime_out(msg, 1);
+			}
+			else if((counter % MIDI_CLOCK_TICKS) == 0){
+				msg[0] = Clock;
+				midi_realtime_out(msg, 1);
+			}
+		break;
+	}
+}
@@ -0,0 +1,355 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Output Plan
+ *
+ * What a track does when it arrives at a step - a plain DAC write,
+ * a slew, an AD or ADSR envelope, a MIDI note, a gate - depends on
+ * the channel type & function and the step's settings, none of
+ * which change while it plays. So rather than working it all out
+ * again on every step, each track has a plan: one small record per
+ * step saying what to do, plus the per-track parts of the slew,
+ * envelope and gate events with the device details already filled
+ * in. next_step() just copies the template and the few per-step
+ * values into the event.
+ *
+ * The plan is also what keeps the editor and playback apart. The
+ * GUI and encoder handlers edit the Europi structure, then call
+ * plan_publish(), which builds a fresh plan from it and hands it
+ * over. Playback only ever reads plans, so it never sees an edit
+ * half made. Each track has three plan buffers (live, pending and
+ * back): the editor builds into back, then atomically swaps it with
+ * pending; the clock swaps pending with live when it's allowed to -
+ * on the track's next step, or at the next bar (Track 0 passing
+ * Step 1) depending on plan_swap_mode. Neither side ever waits for
+ * the other.
+ *
+ * Each track also has a fourth, cue, buffer, for switching to a
+ * whole new Pattern (see europi_song.c). plan_cue() builds the next
+ * Pattern's plans into them ahead of time, and at the next bar the
+ * clock swaps every track's cue and live buffers in one go.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "europi.h"
+
+extern struct europi Europi;
+extern struct playstate Playstate;
+
+#define PLAN_FRESH 0x04		/* pending holds a plan the clock hasn't picked up yet */
+
+/* States of the cue buffers */
+#define PLAN_CUE_IDLE	0		/* Owned by plan_cue() */
+#define PLAN_CUE_READY	1		/* Waiting for the next bar */
+#define PLAN_CUE_TAKEN	2		/* Swapped in by the clock, waiting for plan_cue_done() */
+
+struct plan_slot {
+	struct plan_track buf[4];
+	int live;				/* Buffer being played - only touched by the clock */
+	int back;				/* Buffer being built - only touched by plan_publish() */
+	int pending;			/* Latest finished buffer, | PLAN_FRESH until it's been swapped in */
+	int cue;				/* Buffer holding the next Pattern's plan */
+};
+static struct plan_slot plan_slots[MAX_TRACKS];
+static pthread_mutex_t plan_publish_lock = PTHREAD_MUTEX_INITIALIZER;
+static int plan_cue_state = PLAN_CUE_IDLE;
+
+int plan_swap_mode = PLAN_SWAP_STEP;
+
+/*
+ * PLAN_BUILD
+ * Works out the plan for every step of the passed track
+ */
+static void plan_build(int track, const struct track *pTrack, struct plan_track *pPlan)
+{
+	const struct channel *pCV = &pTrack->channels[CV_OUT];
+	const struct channel *pGate = &pTrack->channels[GATE_OUT];
+	struct plan_step *pStep;
+	int cv_action = PLAN_CV_NONE;
+	int step;
+
+	pPlan->cv_handle = pCV->i2c_handle;
+	pPlan->cv_address = pCV->i2c_address;
+	pPlan->cv_channel = pCV->i2c_channel;
+	pPlan->last_step = (pTrack->last_step < 1) ? 1 : (pTrack->last_step > MAX_STEPS) ? MAX_STEPS : pTrack->last_step;
+	// Which half of a Pendulum is playing is the playhead's business
+	pPlan->direction = (pTrack->direction == Pendulum_B) ? Pendulum_F : pTrack->direction;
+	pPlan->seed = pTrack->seed;
+
+	memset(&pPlan->slew, 0, sizeof(struct slew));
+	pPlan->slew.track = track;
+	pPlan->slew.i2c_handle = pCV->i2c_handle;
+	pPlan->slew.i2c_address = pCV->i2c_address;
+	pPlan->slew.i2c_channel = pCV->i2c_channel;
+
+	// AD always starts and ends on Zero
+	memset(&pPlan->ad, 0, sizeof(struct ad));
+	pPlan->ad.track = track;
+	pPlan->ad.i2c_handle = pCV->i2c_handle;
+	pPlan->ad.i2c_address = pCV->i2c_address;
+	pPlan->ad.i2c_channel = pCV->i2c_channel;
+	pPlan->ad.a_start_value = pCV->scale_zero;
+	pPlan->ad.a_length = pTrack->ad_adsr.a_length;
+	pPlan->ad.d_end_value = pCV->scale_zero;
+	pPlan->ad.d_length = pTrack->ad_adsr.d_length;
+	pPlan->ad.shot_type = Repeat;
+
+	// ADSR starts and ends on Zero. sustain level is a % of the max level
+	memset(&pPlan->adsr, 0, sizeof(struct adsr));
+	pPlan->adsr.track = track;
+	pPlan->adsr.i2c_handle = pCV->i2c_handle;
+	pPlan->adsr.i2c_address = pCV->i2c_address;
+	pPlan->adsr.i2c_channel = pCV->i2c_channel;
+	pPlan->adsr.a_start_value = pCV->scale_zero;
+	pPlan->adsr.a_length = pTrack->ad_adsr.a_length;
+	pPlan->adsr.d_length = pTrack->ad_adsr.d_length;
+	pPlan->adsr.s_level = pTrack->ad_adsr.s_level;
+	pPlan->adsr.s_length = pTrack->ad_adsr.s_length;
+	pPlan->adsr.r_end_value = pCV->scale_zero;
+	pPlan->adsr.r_length = pTrack->ad_adsr.r_length;
+
+	// MIDI Minions have no Gate output, so the note is played by a Gate event
+	memset(&pPlan->midi, 0, sizeof(struct gate));
+	pPlan->midi.track = track;
+	pPlan->midi.i2c_handle = pCV->i2c_handle;
+	pPlan->midi.i2c_address = pCV->i2c_address;
+	pPlan->midi.i2c_channel = pCV->i2c_channel;
+	pPlan->midi.i2c_device = DEV_SC16IS750;
+	pPlan->midi.midi_velocity = 0x40;
+
+	memset(&pPlan->gate, 0, sizeof(struct gate));
+	pPlan->gate.track = track;
+	pPlan->gate.i2c_handle = pGate->i2c_handle;
+	pPlan->gate.i2c_address = pGate->i2c_address;
+	pPlan->gate.i2c_channel = pGate->i2c_channel;
+	pPlan->gate.i2c_device = pGate->i2c_device;
+
+	if(pCV->enabled == TRUE){
+		switch(pCV->type){
+			default:
+			case CHNL_TYPE_CV:
+				switch(pCV->function){
+					default:
+					case CV:
+						cv_action = PLAN_CV_SET;
+					break;
+					case AD:
+						cv_action = PLAN_CV_AD;
+					break;
+					case ADSR:
+						cv_action = PLAN_CV_ADSR;
+					break;
+				}
+			break;
+			case CHNL_TYPE_MIDI:
+				cv_action = PLAN_CV_MIDI;
+			break;
+		}
+	}
+
+	for(step = 0; step < MAX_STEPS; step++){
+		pStep = &pPlan->steps[step];
+		pStep->cv_action = cv_action;
+		if((cv_action == PLAN_CV_SET) && (pCV->steps[step].slew_type != Off)) pStep->cv_action = PLAN_CV_SLEW;
+		pStep->gate = (pGate->enabled == TRUE) ? TRUE : FALSE;
+		pStep->gate_type = pGate->steps[step].gate_type;
+		pStep->ratchets = pGate->steps[step].ratchets;
+		pStep->rhythm = euclid(pGate->steps[step].ratchets, pGate->steps[step].fill, pGate->steps[step].rotation);
+		pStep->midi_note = (cv_action == PLAN_CV_MIDI) ? pitch2midi(pCV->steps[step].raw_value) : 0;
+		pStep->repetitions = pGate->steps[step].repetitions;
+		pStep->slew_type = pCV->steps[step].slew_type;
+		pStep->slew_shape = pCV->steps[step].slew_shape;
+		pStep->value = pCV->steps[step].scaled_value;
+		pStep->slew_length = pCV->steps[step].slew_length;
+	}
+}
+
+/*
+ * PLAN_INIT
+ * Sets up each track's plan buffers. Until something is
+ * published, every track's plan is to do nothing
+ */
+void plan_init(void)
+{
+	int track;
+	memset(plan_slots, 0, sizeof(plan_slots));
+	for(track = 0; track < (MAX_TRACKS); track++){
+		plan_slots[track].live = 0;
+		plan_slots[track].pending = 1;
+		plan_slots[track].back = 2;
+		plan_slots[track].cue = 3;
+	}
+}
+
+/*
+ * PLAN_GET
+ * Returns the plan the passed track is currently playing. Only
+ * for use by the clock (next_step)
+ */
+struct plan_track *plan_get(int track)
+{
+	return &plan_slots[track].buf[plan_slots[track].live];
+}
+
+/*
+ * PLAN_SWAP
+ * Called by the clock as a track arrives at a step. If a new plan
+ * has been published for the track, and plan_swap_mode allows it
+ * at this point, it becomes the live one. Returns the live plan
+ */
+struct plan_track *plan_swap(int track, int at_bar)
+{
+	struct plan_slot *pSlot = &plan_slots[track];
+	if((__atomic_load_n(&pSlot->pending, __ATOMIC_ACQUIRE) & PLAN_FRESH) && ((plan_swap_mode == PLAN_SWAP_STEP) || (at_bar == TRUE))){
+		pSlot->live = __atomic_exchange_n(&pSlot->pending, pSlot->live, __ATOMIC_ACQ_REL) & 0x03;
+		// Loop length and direction change along with the steps
+		playhead_apply(track, pSlot->buf[pSlot->live].last_step, pSlot->buf[pSlot->live].direction, pSlot->buf[pSlot->live].seed);
+	}
+	return &pSlot->buf[pSlot->live];
+}
+
+/*
+ * PLAN_PUBLISH
+ * Builds a new plan from the passed track's current settings, and
+ * hands it to the clock. Call after editing a track's steps,
+ * channel settings or envelope shape. If an earlier plan hasn't
+ * been picked up yet, it is simply replaced.
+ */
+void plan_publish(int track)
+{
+	struct plan_slot *pSlot;
+	if((track < 0) || (track >= (MAX_TRACKS))) return;
+	pSlot = &plan_slots[track];
+	pthread_mutex_lock(&plan_publish_lock);
+	// Europi is about to be replaced by a new Pattern, so this edit
+	// is to the old one - it's kept when the old one is stored
+	if(__atomic_load_n(&plan_cue_state, __ATOMIC_ACQUIRE) != PLAN_CUE_TAKEN){
+		plan_build(track, &Europi.tracks[track], &pSlot->buf[pSlot->back]);
+		pSlot->back = __atomic_exchange_n(&pSlot->pending, pSlot->back | PLAN_FRESH, __ATOMIC_ACQ_REL) & 0x03;
+	}
+	pthread_mutex_unlock(&plan_publish_lock);
+}
+
+/*
+ * PLAN_PUBLISH_ALL
+ * plan_publish() for every track - eg after loading a sequence or
+ * re-scanning the hardware
+ */
+void plan_publish_all(void)
+{
+	int track;
+	for(track = 0; track < (MAX_TRACKS); track++) plan_publish(track);
+}
+
+/*
+ * PLAN_CUE
+ * Builds the plans for a whole new Pattern into the cue buffers,
+ * ready for plan_cue_take() to switch to at the next bar. Replaces
+ * anything already cued. Returns -1 if the clock has just switched
+ * to the last one cued, and it hasn't been finished off by
+ * plan_cue_done() yet
+ */
+int plan_cue(const struct track *tracks[])
+{
+	int expected = PLAN_CUE_READY;
+	int track;
+	pthread_mutex_lock(&plan_publish_lock);
+	// Take back anything already cued, unless the clock beats us to it
+	__atomic_compare_exchange_n(&plan_cue_state, &expected, PLAN_CUE_IDLE, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&plan_cue_state, __ATOMIC_ACQUIRE) != PLAN_CUE_IDLE){
+		pthread_mutex_unlock(&plan_publish_lock);
+		return -1;
+	}
+	for(track = 0; track < (MAX_TRACKS); track++){
+		plan_build(track, tracks[track], &plan_slots[track].buf[plan_slots[track].cue]);
+	}
+	__atomic_store_n(&plan_cue_state, PLAN_CUE_READY, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&plan_publish_lock);
+	return 0;
+}
+
+/*
+ * PLAN_CUE_TAKE
+ * Called by the clock at the bar. If a Pattern is cued, every
+ * track switches to it, along with its length and direction, and
+ * any edits published for the old Pattern are dropped. Returns TRUE
+ * if it switched
+ */
+int plan_cue_take(void)
+{
+	struct plan_slot *pSlot;
+	int expected = PLAN_CUE_READY;
+	int track, live;
+	if(!__atomic_compare_exchange_n(&plan_cue_state, &expected, PLAN_CUE_TAKEN, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return FALSE;
+	for(track = 0; track < (MAX_TRACKS); track++){
+		pSlot = &plan_slots[track];
+		__atomic_and_fetch(&pSlot->pending, ~PLAN_FRESH, __ATOMIC_ACQ_REL);
+		live = pSlot->live;
+		pSlot->live = pSlot->cue;
+		pSlot->cue = live;
+		playhead_apply(track, pSlot->buf[pSlot->live].last_step, pSlot->buf[pSlot->live].direction, pSlot->buf[pSlot->live].seed);
+		Playstate.repeat_counter[track] = 0;
+	}
+	return TRUE;
+}
+
+/*
+ * PLAN_CUE_TAKEN
+ * TRUE if the clock has switched to the cued Pattern, and
+ * plan_cue_done() needs to be called
+ */
+int plan_cue_taken(void)
+{
+	return (__atomic_load_n(&plan_cue_state, __ATOMIC_ACQUIRE) == PLAN_CUE_TAKEN) ? TRUE : FALSE;
+}
+
+/*
+ * PLAN_CUE_DONE
+ * Called (with plan_lock() held) once Europi has been loaded with
+ * the Pattern the clock switched to, so edits can be published again
+ */
+void plan_cue_done(void)
+{
+	__atomic_store_n(&plan_cue_state, PLAN_CUE_IDLE, __ATOMIC_RELEASE);
+}
+
+/*
+ * PLAN_LOCK / PLAN_UNLOCK
+ * Hold off plan_publish() and plan_cue() while Europi is replaced
+ */
+void plan_lock(void)
+{
+	pthread_mutex_lock(&plan_publish_lock);
+}
+
+void plan_unlock(void)
+{
+	pthread_mutex_unlock(&plan_publish_lock);
+}
@@ -0,0 +1,269 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+/*
+ * Playhead
+ *
+ * Rather than working out where each track goes next from its
+ * direction every time it steps, each track has a precomputed
+ * cycle: the order its steps are played in, and which of those
+ * fire the Step 1 pulse. Advancing is then just moving on to the
+ * next entry. The cycle is only rebuilt when the track's last_step
+ * or direction changes.
+ *
+ * Each play mode is an entry in playmodes[], with a function that
+ * builds its cycle and one that picks the next entry, so a new mode
+ * only needs a new entry (and a new track_dir_t value).
+ *
+ * All of this works from the packed copies of each track's
+ * settings in Playstate, rather than struct track itself. Edits to
+ * a track's last_step, direction or seed reach Playstate through
+ * its output plan (plan_publish()), so they're heard at the same
+ * moment as the rest of the edit, and only the clock ever writes
+ * them. Pendulum's running direction is only kept in Playstate.
+ *
+ * Random uses its own xorshift generator per track, rather than
+ * rand(), so it never takes a lock on the clock thread, and is
+ * reseeded from the track's seed each time the track is sent back
+ * to Step 1 - the same seed plays the same take.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "europi.h"
+
+extern struct playstate Playstate;
+
+static struct playhead playheads[MAX_TRACKS];
+
+/* Forwards - 0, 1 ... n-1 */
+static void build_forwards(struct playhead *ph, int n)
+{
+	int i;
+	for(i = 0; i < n; i++){
+		ph->cycle[i].step = i;
+		ph->cycle[i].direction = Forwards;
+	}
+	ph->length = n;
+}
+
+/* Backwards - 0, n-1, n-2 ... 1, so Step 1 is where it wraps */
+static void build_backwards(struct playhead *ph, int n)
+{
+	int i;
+	ph->cycle[0].step = 0;
+	ph->cycle[0].direction = Backwards;
+	for(i = 1; i < n; i++){
+		ph->cycle[i].step = n - i;
+		ph->cycle[i].direction = Backwards;
+	}
+	ph->length = n;
+}
+
+/*
+ * Pendulum - 0, 1 ... n-1 going forwards, then n-1 ... 0 going
+ * backwards, so each end step is played twice
+ */
+static void build_pendulum(struct playhead *ph, int n)
+{
+	int i;
+	for(i = 0; i < n; i++){
+		ph->cycle[i].step = i;
+		ph->cycle[i].direction = Pendulum_F;
+		ph->cycle[n + i].step = n - 1 - i;
+		ph->cycle[n + i].direction = Pendulum_B;
+	}
+	ph->length = n * 2;
+}
+
+/* Random picks from the same entries as Forwards */
+static void build_random(struct playhead *ph, int n)
+{
+	int i;
+	for(i = 0; i < n; i++){
+		ph->cycle[i].step = i;
+		ph->cycle[i].direction = Random;
+	}
+	ph->length = n;
+}
+
+static int advance_cycle(struct playhead *ph)
+{
+	return (ph->index + 1 < ph->length) ? ph->index + 1 : 0;
+}
+
+/*
+ * Seeds a track's generator. The seed is mixed with the track
+ * number, so tracks sharing a seed still play different orders
+ */
+static void playhead_seed(struct playhead *ph, uint32_t seed, int track)
+{
+	uint32_t x = seed + ((uint32_t)track * 0x9E3779B9u);
+	x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+	x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+	x ^= x >> 16;
+	// xorshift gets stuck on zero
+	ph->rng = (x != 0) ? x : 0x6D2B79F5u;
+}
+
+static int advance_random(struct playhead *ph)
+{
+	uint32_t x = ph->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ph->rng = x;
+	// Scale to the cycle length without a divide
+	return (int)(((uint64_t)x * (uint32_t)ph->length) >> 32);
+}
+
+/*
+ * Play modes, indexed by track_dir_t. Pendulum_B is just the second
+ * half of the Pendulum cycle, so shares its table
+ */
+static const struct playmode playmodes[] = {
+	[Forwards]		= {Forwards,	build_forwards,		advance_cycle},
+	[Backwards]		= {Backwards,	build_backwards,	advance_cycle},
+	[Pendulum_F]	= {Pendulum_F,	build_pendulum,		advance_cycle},
+	[Pendulum_B]	= {Pendulum_F,	build_pendulum,		advance_cycle},
+	[Random]		= {Random,		build_random,		advance_random},
+};
+
+/*
+ * PLAYHEAD_FIND
+ * Finds the cycle entry for the track's current step, preferring
+ * one going the same way as the track (for Pendulum, where each
+ * step is in the cycle twice). If the step isn't in the cycle (eg
+ * the track has just been shortened) it lands on the last entry,
+ * so the next advance wraps round to Step 1.
+ */
+static void playhead_find(struct playhead *ph, int track)
+{
+	int i;
+	int found = -1;
+	for(i = 0; i < ph->length; i++){
+		if(ph->cycle[i].step != Playstate.current_step[track]) continue;
+		if(ph->cycle[i].direction == Playstate.direction[track]){
+			found = i;
+			break;
+		}
+		if(found < 0) found = i;
+	}
+	ph->index = (found < 0) ? ph->length - 1 : found;
+}
+
+/*
+ * PLAYHEAD_BUILD
+ * (Re)builds a track's cycle for its current last_step and
+ * direction, and finds where the track has got to in it
+ */
+static void playhead_build(int track)
+{
+	struct playhead *ph = &playheads[track];
+	const struct playmode *mode;
+	// Nothing has been applied yet (eg just after start up)
+	if(Playstate.last_step[track] < 1) Playstate.last_step[track] = 1;
+	mode = &playmodes[Playstate.direction[track]];
+	mode->build(ph, Playstate.last_step[track]);
+	ph->mode = mode;
+	ph->key_last_step = Playstate.last_step[track];
+	ph->key_mode = mode->key;
+	playhead_find(ph, track);
+}
+
+/*
+ * PLAYHEAD_CHECK
+ * Makes sure the track's cycle is up to date, and that it knows
+ * where the track has got to in it
+ */
+static void playhead_check(struct playhead *ph, int track)
+{
+	// Rebuild if the track has been edited since the table was built
+	if((ph->mode == NULL) || (ph->key_last_step != Playstate.last_step[track]) || (ph->key_mode != playmodes[Playstate.direction[track]].key)){
+		playhead_build(track);
+	}
+	// Something else (eg a file load, or the GUI) may have moved the track
+	else if(ph->cycle[ph->index].step != Playstate.current_step[track]){
+		playhead_find(ph, track);
+	}
+}
+
+/*
+ * PLAYHEAD_APPLY
+ * Sets the last_step, direction and seed the passed track plays
+ * with. Called by the clock when it swaps in a new output plan. A
+ * Pendulum carries on whichever way it was going, unless the mode
+ * itself has changed (the cycle is rebuilt lazily, on the track's
+ * next step)
+ */
+void playhead_apply(int track, int last_step, int direction, uint32_t seed)
+{
+	if(last_step < 1) last_step = 1;
+	if(last_step > MAX_STEPS) last_step = MAX_STEPS;
+	if(((unsigned)direction) >= (sizeof(playmodes) / sizeof(playmodes[0]))) direction = Forwards;
+	Playstate.last_step[track] = last_step;
+	if(playmodes[direction].key != playmodes[Playstate.direction[track]].key) Playstate.direction[track] = direction;
+	Playstate.seed[track] = seed;
+}
+
+/*
+ * PLAYHEAD_ADVANCE
+ * Moves the passed track on to the next step in its play order (or
+ * back to Step 1, if step_one is set), updating current_step and,
+ * for Pendulum, which way it's going. Returns TRUE if the track has
+ * arrived at a point that fires the Step 1 pulse.
+ */
+int playhead_advance(int track, int step_one)
+{
+	struct playhead *ph = &playheads[track];
+	struct playhead_entry *entry;
+	playhead_check(ph, track);
+	if(ph->rng == 0) playhead_seed(ph, Playstate.seed[track], track);
+	if(step_one == TRUE){
+		ph->index = 0;
+		playhead_seed(ph, Playstate.seed[track], track);
+	}
+	else ph->index = ph->mode->advance(ph);
+	entry = &ph->cycle[ph->index];
+	Playstate.current_step[track] = entry->step;
+	// Pendulum turning round
+	Playstate.direction[track] = entry->direction;
+	return (ph->index == 0) ? TRUE : FALSE;
+}
+
+/*
+ * PLAYHEAD_POSITION
+ * How many steps into its play order the passed track's next step
+ * will be, ie 0 if it's about to go back to Step 1. Random has no
+ * fixed order, so this is only meaningful for the other modes.
+ * Called from the clock thread
+ */
+int playhead_position(int track)
+{
+	struct playhead *ph = &playheads[track];
+	playhead_check(ph, track);
+	return (ph->index + 1 < ph->length) ? ph->index + 1 : 0;
+}
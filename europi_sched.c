@@ -0,0 +1,381 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+/*
+ * Output Event Scheduler
+ *
+ * Rather than launching a detached thread for every Gate, Slew,
+ * AD and ADSR on every step, next_step() queues a timed event for
+ * each of them here. A single long-lived Scheduler thread holds
+ * the pending events in a min-heap ordered by deadline, sleeps
+ * until the earliest one is due, and then calls its handler.
+ * Handlers that need to do something else later on (turn a Gate
+ * off, output the next point of a slew etc) update the deadline
+ * and ask to be re-queued.
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <pigpio.h>
+
+#include "europi.h"
+
+extern int ThreadEnd;
+extern uint32_t slew_interval;
+
+pthread_t schedThreadId;				/* The one-and-only Scheduler thread */
+int schedThreadLaunched = FALSE;
+static pthread_mutex_t sched_lock;
+static pthread_cond_t sched_cond;
+static struct sched_event sched_heap[SCHED_MAX_EVENTS];
+static int sched_count = 0;
+
+/* Descriptor pools - see pool_claim() */
+static struct gate gate_pool[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static struct slew slew_pool[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static struct ad ad_pool[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static struct adsr adsr_pool[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static volatile int gate_busy[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static volatile int slew_busy[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static volatile int ad_busy[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static volatile int adsr_busy[(MAX_TRACKS) * POOL_SLOTS_PER_TRACK];
+static unsigned gate_cursor[MAX_TRACKS];
+static unsigned slew_cursor[MAX_TRACKS];
+static unsigned ad_cursor[MAX_TRACKS];
+static unsigned adsr_cursor[MAX_TRACKS];
+static volatile int ramps_active = 0;	/* Slews, ADs and ADSRs currently claimed */
+
+/* TRUE if tick a falls before tick b, allowing for the 32 bit wrap */
+#define SCHED_BEFORE(a,b) ((int32_t)((a) - (b)) < 0)
+
+/*
+ * SCHED_TICK
+ * Microsecond timestamp taken from the Monotonic clock, so it
+ * can't be dragged about by NTP. Like gpioTick() it wraps every
+ * 71 minutes or so, so always compare ticks by difference.
+ */
+uint32_t sched_tick(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+/* Standard binary heap sift-up / sift-down on the deadline */
+static void sched_sift_up(int i)
+{
+	struct sched_event tmp;
+	while(i > 0){
+		int parent = (i - 1) / 2;
+		if(!SCHED_BEFORE(sched_heap[i].deadline, sched_heap[parent].deadline)) break;
+		tmp = sched_heap[parent];
+		sched_heap[parent] = sched_heap[i];
+		sched_heap[i] = tmp;
+		i = parent;
+	}
+}
+
+static void sched_sift_down(int i)
+{
+	struct sched_event tmp;
+	while(1){
+		int left = (2 * i) + 1;
+		int right = left + 1;
+		int smallest = i;
+		if((left < sched_count) && SCHED_BEFORE(sched_heap[left].deadline, sched_heap[smallest].deadline)) smallest = left;
+		if((right < sched_count) && SCHED_BEFORE(sched_heap[right].deadline, sched_heap[smallest].deadline)) smallest = right;
+		if(smallest == i) break;
+		tmp = sched_heap[smallest];
+		sched_heap[smallest] = sched_heap[i];
+		sched_heap[i] = tmp;
+		i = smallest;
+	}
+}
+
+/* Push an event - caller must hold sched_lock */
+static int sched_push(struct sched_event *ev)
+{
+	if(sched_count >= SCHED_MAX_EVENTS) return -1;
+	sched_heap[sched_count] = *ev;
+	sched_sift_up(sched_count);
+	sched_count++;
+	return 0;
+}
+
+/* Pop the earliest event - caller must hold sched_lock */
+static void sched_pop(struct sched_event *ev)
+{
+	*ev = sched_heap[0];
+	sched_count--;
+	if(sched_count > 0){
+		sched_heap[0] = sched_heap[sched_count];
+		sched_sift_down(0);
+	}
+}
+
+/*
+ * SCHED_ADD
+ * Queues the passed handler to be called at (or as soon as
+ * possible after) the passed deadline. Returns 0 on success
+ * or -1 if the event queue is full, in which case the caller
+ * still owns arg and should tidy it up.
+ */
+int sched_add(uint32_t deadline, int (*handler)(struct sched_event *), void *arg)
+{
+	struct sched_event ev;
+	int retval;
+	int wake;
+	ev.deadline = deadline;
+	ev.handler = handler;
+	ev.arg = arg;
+	ev.phase = 0;
+	ev.count = 0;
+	ev.start = deadline;
+	pthread_mutex_lock(&sched_lock);
+	// Only need to wake the Scheduler if this will be the earliest event
+	wake = (sched_count == 0) || SCHED_BEFORE(deadline, sched_heap[0].deadline);
+	retval = sched_push(&ev);
+	if((retval == 0) && wake) pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+	if(retval < 0) log_msg("Scheduler queue full\n");
+	return retval;
+}
+
+/*
+ * Scheduler Thread - Joinable thread that lives for the
+ * whole time the prog is running. It fires every event
+ * that is due, then sleeps until the next deadline or
+ * until sched_add() signals that something earlier has
+ * been queued.
+ */
+void *SchedulerThread(void *arg)
+{
+	struct sched_event ev;
+	struct timespec ts;
+	int32_t wait;
+	uint32_t govern_tick = sched_tick();
+	pthread_mutex_lock(&sched_lock);
+	while(!ThreadEnd){
+		if(sched_count == 0){
+			// Nothing queued. Wake up occasionally anyway so ThreadEnd is noticed
+			wait = 10000;
+		}
+		else {
+			wait = (int32_t)(sched_heap[0].deadline - sched_tick());
+		}
+		if(wait > 0){
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			ts.tv_nsec += (long)wait * 1000;
+			while(ts.tv_nsec >= 1000000000){
+				ts.tv_nsec -= 1000000000;
+				ts.tv_sec++;
+			}
+			pthread_cond_timedwait(&sched_cond, &sched_lock, &ts);
+			continue;
+		}
+		/* Fire everything that is now due */
+		while((sched_count > 0) && !SCHED_BEFORE(sched_tick(), sched_heap[0].deadline)){
+			sched_pop(&ev);
+			pthread_mutex_unlock(&sched_lock);
+			if(ev.handler(&ev) == TRUE){
+				pthread_mutex_lock(&sched_lock);
+				if(sched_push(&ev) < 0) log_msg("Scheduler queue full\n");
+			}
+			else {
+				pthread_mutex_lock(&sched_lock);
+			}
+		}
+		/* Handlers only stage their CV and Gate changes, so
+		 * write them out now, one transaction per device */
+		pthread_mutex_unlock(&sched_lock);
+		DACFlush();
+		GATEFlush();
+		MIDIFlush(I2C_LANE_GATE);
+		/* Re-share the bus between the running ramps. They time
+		 * their points from elapsed time, so a change to
+		 * slew_interval part way through a ramp is harmless */
+		if((sched_tick() - govern_tick) >= RAMP_GOVERN_PERIOD){
+			govern_tick = sched_tick();
+			slew_interval = i2c_ramp_interval(ramps_active);
+		}
+		pthread_mutex_lock(&sched_lock);
+	}
+	pthread_mutex_unlock(&sched_lock);
+	return NULL;
+}
+
+/*
+ * SCHED_START
+ * Initialises the event queue and launches the
+ * Scheduler thread. Called once from startup()
+ */
+void sched_start(void)
+{
+	pthread_condattr_t cond_attr;
+	struct sched_param param;
+	sched_count = 0;
+	if (pthread_mutex_init(&sched_lock, NULL) != 0){
+		log_msg("Scheduler mutex init failed\n");
+	}
+	// The condition variable needs to time out against the same clock as sched_tick()
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sched_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	if(pthread_create(&schedThreadId, NULL, SchedulerThread, NULL) != 0){
+		log_msg("Error creating Scheduler thread\n");
+		return;
+	}
+	schedThreadLaunched = TRUE;
+	// Run the Scheduler ahead of the GUI if we're allowed to
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 10;
+	if(pthread_setschedparam(schedThreadId, SCHED_FIFO, &param) != 0){
+		log_msg("Scheduler running without RT priority\n");
+	}
+}
+
+/*
+ * SCHED_STOP
+ * Waits for the Scheduler thread to notice ThreadEnd, then
+ * tidies up. Anything still queued is simply dropped, as
+ * shutdown() sets all the outputs to a known state anyway
+ */
+void sched_stop(void)
+{
+	if(schedThreadLaunched == TRUE){
+		pthread_mutex_lock(&sched_lock);
+		pthread_cond_signal(&sched_cond);
+		pthread_mutex_unlock(&sched_lock);
+		pthread_join(schedThreadId, NULL);
+		schedThreadLaunched = FALSE;
+	}
+	pthread_cond_destroy(&sched_cond);
+	pthread_mutex_destroy(&sched_lock);
+}
+
+/*
+ * POOL_CLAIM
+ * Claims a free slot from the passed track's ring of a descriptor
+ * pool, starting just after the last slot handed out so slots get
+ * re-used round-robin. Slots are claimed with an atomic compare and
+ * swap on their busy flag and released by the Scheduler thread once
+ * the handler has finished with them, so no locks and no malloc are
+ * needed on the clock path. Returns the slot index, or -1 if every
+ * slot belonging to the track is still in use.
+ */
+static int pool_claim(volatile int *busy, unsigned *cursor, int track)
+{
+	int i;
+	int slot;
+	if((track < 0) || (track >= (MAX_TRACKS))) return -1;
+	for(i = 0; i < POOL_SLOTS_PER_TRACK; i++){
+		slot = (cursor[track] + i) % POOL_SLOTS_PER_TRACK;
+		if(__sync_bool_compare_and_swap(&busy[(track * POOL_SLOTS_PER_TRACK) + slot], 0, 1)){
+			cursor[track] = slot + 1;
+			return (track * POOL_SLOTS_PER_TRACK) + slot;
+		}
+	}
+	return -1;
+}
+
+struct gate *gate_alloc(int track)
+{
+	int slot = pool_claim(gate_busy, gate_cursor, track);
+	if(slot < 0){
+		log_msg("Gate pool full, Trk: %d\n", track);
+		return NULL;
+	}
+	return &gate_pool[slot];
+}
+
+void gate_free(struct gate *pGate)
+{
+	__sync_lock_release(&gate_busy[pGate - gate_pool]);
+}
+
+struct slew *slew_alloc(int track)
+{
+	int slot = pool_claim(slew_busy, slew_cursor, track);
+	if(slot < 0){
+		log_msg("Slew pool full, Trk: %d\n", track);
+		return NULL;
+	}
+	__sync_fetch_and_add(&ramps_active, 1);
+	return &slew_pool[slot];
+}
+
+void slew_free(struct slew *pSlew)
+{
+	__sync_fetch_and_sub(&ramps_active, 1);
+	__sync_lock_release(&slew_busy[pSlew - slew_pool]);
+}
+
+struct ad *ad_alloc(int track)
+{
+	int slot = pool_claim(ad_busy, ad_cursor, track);
+	if(slot < 0){
+		log_msg("AD pool full, Trk: %d\n", track);
+		return NULL;
+	}
+	__sync_fetch_and_add(&ramps_active, 1);
+	return &ad_pool[slot];
+}
+
+void ad_free(struct ad *pAD)
+{
+	__sync_fetch_and_sub(&ramps_active, 1);
+	__sync_lock_release(&ad_busy[pAD - ad_pool]);
+}
+
+struct adsr *adsr_alloc(int track)
+{
+	int slot = pool_claim(adsr_busy, adsr_cursor, track);
+	if(slot < 0){
+		log_msg("ADSR pool full, Trk: %d\n", track);
+		return NULL;
+	}
+	__sync_fetch_and_add(&ramps_active, 1);
+	return &adsr_pool[slot];
+}
+
+void adsr_free(struct adsr *pADSR)
+{
+	__sync_fetch_and_sub(&ramps_active, 1);
+	__sync_lock_release(&adsr_busy[pADSR - adsr_pool]);
+}
+
+/*
+ * SCHED_RAMPS_ACTIVE
+ * Number of Slews, ADs and ADSRs that are currently running
+ * (or about to), which the ramp governor shares the bus between
+ */
+int sched_ramps_active(void)
+{
+	return ramps_active;
+}
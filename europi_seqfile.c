@@ -0,0 +1,413 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Sequence files
+ *
+ * Sequences used to be saved as a straight dump of the Europi
+ * structure, which tied the file to the exact layout of struct
+ * step etc. in whichever build wrote it. They are now written
+ * field by field, little-endian, behind a header with a magic
+ * number and version:
+ *
+ *   Header   - "EPSQ", version, tracks, channels, steps (16 bytes)
+ *   For each track:
+ *     Track    - last_step, direction, AD/ADSR shape, seed etc (32 bytes)
+ *     For each channel:
+ *       Channel  - output settings (32 bytes)
+ *       Steps    - STEP_RECORD_SIZE bytes each
+ *
+ * Files without the magic number are read as the old raw dumps,
+ * so existing sequences still load - they'll be written out in
+ * the new format the next time they're saved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "europi.h"
+
+extern struct europi Europi;
+
+#define SEQ_MAGIC "EPSQ"
+#define SEQ_VERSION 2		/* 2 - adds the track seed */
+#define SEQ_HEADER_SIZE 16
+#define SEQ_TRACK_SIZE 32
+#define SEQ_CHANNEL_SIZE 32
+
+/*
+ * Layout of the old raw sequence dumps. These must not change -
+ * they describe files that are already out there.
+ */
+struct legacy_step {
+	int raw_value;
+	uint16_t scaled_value;
+	enum slew_t slew_type;
+	enum slew_shape_t slew_shape;
+	uint32_t slew_length;
+	enum gate_type_t gate_type;
+	int ratchets;
+	int fill;
+	int repetitions;
+	int repeat_counter;
+};
+struct legacy_channel {
+	struct legacy_step steps[MAX_STEPS];
+	int i2c_handle;
+	int i2c_device;
+	unsigned i2c_address;
+	unsigned i2c_channel;
+	uint16_t scale_zero;
+	uint16_t scale_max;
+	int enabled;
+	int type;
+	enum chnl_function_t function;
+	int quantise;
+	long transpose;
+	int	octaves;
+	int vc_type;
+};
+struct legacy_track {
+	struct legacy_channel channels[MAX_CHANNELS];
+	int selected;
+	int track_busy;
+	int current_step;
+	int last_step;
+	enum track_dir_t direction;
+	struct ad_adsr_t ad_adsr;
+};
+struct legacy_europi {
+	struct legacy_track tracks[MAX_TRACKS];
+};
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * STEP_PACK
+ * Packs a Step into a STEP_RECORD_SIZE byte record:
+ *   0-1   raw_value
+ *   2-3   scaled_value
+ *   4-7   slew_length
+ *   8     slew_type (bits 0-3), slew_shape (bits 4-5)
+ *   9     gate_type
+ *   10    ratchets
+ *   11    fill
+ *   12    repetitions
+ *   13    rotation
+ *   14-15 reserved (zero)
+ */
+void step_pack(const struct step *pStep, uint8_t *rec)
+{
+	put16(&rec[0], pStep->raw_value);
+	put16(&rec[2], pStep->scaled_value);
+	put32(&rec[4], pStep->slew_length);
+	rec[8] = pStep->slew_type | (pStep->slew_shape << 4);
+	rec[9] = pStep->gate_type;
+	rec[10] = pStep->ratchets;
+	rec[11] = pStep->fill;
+	rec[12] = pStep->repetitions;
+	rec[13] = pStep->rotation;
+	rec[14] = rec[15] = 0;
+}
+
+/*
+ * STEP_UNPACK
+ * The reverse of step_pack()
+ */
+void step_unpack(const uint8_t *rec, struct step *pStep)
+{
+	pStep->raw_value = get16(&rec[0]);
+	pStep->scaled_value = get16(&rec[2]);
+	pStep->slew_length = get32(&rec[4]);
+	pStep->slew_type = rec[8] & 0x0F;
+	pStep->slew_shape = (rec[8] >> 4) & 0x03;
+	pStep->gate_type = rec[9];
+	pStep->ratchets = rec[10];
+	pStep->fill = rec[11];
+	pStep->repetitions = rec[12];
+	pStep->rotation = rec[13];
+}
+
+static void track_pack(const struct track *pTrack, uint8_t *rec)
+{
+	memset(rec, 0, SEQ_TRACK_SIZE);
+	rec[0] = pTrack->last_step;
+	rec[1] = pTrack->direction;
+	put16(&rec[2], pTrack->ad_adsr.a_end_value);
+	put16(&rec[4], pTrack->ad_adsr.s_level);
+	rec[6] = pTrack->ad_adsr.shot_type;
+	rec[7] = pTrack->ad_adsr.slope_type;
+	put32(&rec[8], pTrack->ad_adsr.a_length);
+	put32(&rec[12], pTrack->ad_adsr.d_length);
+	put32(&rec[16], pTrack->ad_adsr.s_length);
+	put32(&rec[20], pTrack->ad_adsr.r_length);
+	rec[24] = pTrack->selected;
+	put32(&rec[28], pTrack->seed);
+}
+
+static void track_unpack(const uint8_t *rec, struct track *pTrack)
+{
+	pTrack->last_step = rec[0];
+	pTrack->direction = rec[1];
+	pTrack->ad_adsr.a_end_value = get16(&rec[2]);
+	pTrack->ad_adsr.s_level = get16(&rec[4]);
+	pTrack->ad_adsr.shot_type = rec[6];
+	pTrack->ad_adsr.slope_type = rec[7];
+	pTrack->ad_adsr.a_length = get32(&rec[8]);
+	pTrack->ad_adsr.d_length = get32(&rec[12]);
+	pTrack->ad_adsr.s_length = get32(&rec[16]);
+	pTrack->ad_adsr.r_length = get32(&rec[20]);
+	pTrack->selected = rec[24];
+	// Zero in version 1 files, which is as good a seed as any
+	pTrack->seed = get32(&rec[28]);
+}
+
+static void channel_pack(const struct channel *pChnl, uint8_t *rec)
+{
+	memset(rec, 0, SEQ_CHANNEL_SIZE);
+	put32(&rec[0], pChnl->i2c_handle);
+	put32(&rec[4], (uint32_t)pChnl->transpose);
+	put16(&rec[8], pChnl->scale_zero);
+	put16(&rec[10], pChnl->scale_max);
+	rec[12] = pChnl->i2c_device;
+	rec[13] = pChnl->i2c_address;
+	rec[14] = pChnl->i2c_channel;
+	rec[15] = pChnl->enabled;
+	rec[16] = pChnl->type;
+	rec[17] = pChnl->function;
+	rec[18] = pChnl->quantise;
+	rec[19] = pChnl->octaves;
+	rec[20] = pChnl->vc_type;
+}
+
+static void channel_unpack(const uint8_t *rec, struct channel *pChnl)
+{
+	pChnl->i2c_handle = (int32_t)get32(&rec[0]);
+	pChnl->transpose = (int32_t)get32(&rec[4]);
+	pChnl->scale_zero = get16(&rec[8]);
+	pChnl->scale_max = get16(&rec[10]);
+	pChnl->i2c_device = rec[12];
+	pChnl->i2c_address = rec[13];
+	pChnl->i2c_channel = rec[14];
+	pChnl->enabled = rec[15];
+	pChnl->type = rec[16];
+	pChnl->function = rec[17];
+	pChnl->quantise = rec[18];
+	pChnl->octaves = rec[19];
+	pChnl->vc_type = rec[20];
+}
+
+/*
+ * SEQUENCE_SAVE
+ * Writes the current sequence out to the passed file.
+ * Returns 0 on success, -1 on failure
+ */
+int sequence_save(const char *filename)
+{
+	uint8_t rec[SEQ_TRACK_SIZE];
+	int track, channel, step;
+	int ok = 1;
+	FILE *file = fopen(filename, "wb");
+	if(file == NULL) return -1;
+	memset(rec, 0, SEQ_HEADER_SIZE);
+	memcpy(rec, SEQ_MAGIC, 4);
+	put16(&rec[4], SEQ_VERSION);
+	put16(&rec[6], MAX_TRACKS);
+	put16(&rec[8], MAX_CHANNELS);
+	put16(&rec[10], MAX_STEPS);
+	ok &= (fwrite(rec, SEQ_HEADER_SIZE, 1, file) == 1);
+	for(track = 0; track < (MAX_TRACKS); track++){
+		track_pack(&Europi.tracks[track], rec);
+		ok &= (fwrite(rec, SEQ_TRACK_SIZE, 1, file) == 1);
+		for(channel = 0; channel < MAX_CHANNELS; channel++){
+			channel_pack(&Europi.tracks[track].channels[channel], rec);
+			ok &= (fwrite(rec, SEQ_CHANNEL_SIZE, 1, file) == 1);
+			for(step = 0; step < MAX_STEPS; step++){
+				step_pack(&Europi.tracks[track].channels[channel].steps[step], rec);
+				ok &= (fwrite(rec, STEP_RECORD_SIZE, 1, file) == 1);
+			}
+		}
+	}
+	if(fclose(file) != 0) ok = 0;
+	return ok ? 0 : -1;
+}
+
+/*
+ * Reads a sequence in the current format. A file with more
+ * tracks / channels / steps than this build has is truncated,
+ * one with fewer leaves the rest of the tracks as they were.
+ */
+static int sequence_read(FILE *file, const uint8_t *header, struct europi *pSeq)
+{
+	uint8_t rec[SEQ_CHANNEL_SIZE];
+	int tracks = get16(&header[6]);
+	int channels = get16(&header[8]);
+	int steps = get16(&header[10]);
+	int track, channel, step;
+	struct step dummy_step;
+	struct channel *pChnl;
+	if(get16(&header[4]) > SEQ_VERSION){
+		log_msg("Sequence file version %d is newer than this software\n", get16(&header[4]));
+		return -1;
+	}
+	for(track = 0; track < tracks; track++){
+		if(fread(rec, SEQ_TRACK_SIZE, 1, file) != 1) return -1;
+		if(track < (MAX_TRACKS)) track_unpack(rec, &pSeq->tracks[track]);
+		for(channel = 0; channel < channels; channel++){
+			if(fread(rec, SEQ_CHANNEL_SIZE, 1, file) != 1) return -1;
+			pChnl = ((track < (MAX_TRACKS)) && (channel < MAX_CHANNELS)) ? &pSeq->tracks[track].channels[channel] : NULL;
+			if(pChnl != NULL) channel_unpack(rec, pChnl);
+			for(step = 0; step < steps; step++){
+				if(fread(rec, STEP_RECORD_SIZE, 1, file) != 1) return -1;
+				step_unpack(rec, ((pChnl != NULL) && (step < MAX_STEPS)) ? &pChnl->steps[step] : &dummy_step);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Reads one of the old raw dumps, and converts it
+ */
+static int sequence_read_legacy(FILE *file, struct europi *pSeq)
+{
+	struct legacy_europi *pOld;
+	struct legacy_channel *pOldChnl;
+	struct legacy_step *pOldStep;
+	struct channel *pChnl;
+	struct step *pStep;
+	int track, channel, step;
+	long size;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	if(size != (long)sizeof(struct legacy_europi)){
+		log_msg("Sequence file is %ld bytes, not a recognised format\n", size);
+		return -1;
+	}
+	pOld = malloc(sizeof(struct legacy_europi));
+	if(pOld == NULL) return -1;
+	rewind(file);
+	if(fread(pOld, sizeof(struct legacy_europi), 1, file) != 1){
+		free(pOld);
+		return -1;
+	}
+	for(track = 0; track < (MAX_TRACKS); track++){
+		pSeq->tracks[track].selected = pOld->tracks[track].selected;
+		pSeq->tracks[track].last_step = pOld->tracks[track].last_step;
+		pSeq->tracks[track].direction = pOld->tracks[track].direction;
+		pSeq->tracks[track].ad_adsr = pOld->tracks[track].ad_adsr;
+		pSeq->tracks[track].seed = 0;
+		for(channel = 0; channel < MAX_CHANNELS; channel++){
+			pOldChnl = &pOld->tracks[track].channels[channel];
+			pChnl = &pSeq->tracks[track].channels[channel];
+			pChnl->i2c_handle = pOldChnl->i2c_handle;
+			pChnl->i2c_device = pOldChnl->i2c_device;
+			pChnl->i2c_address = pOldChnl->i2c_address;
+			pChnl->i2c_channel = pOldChnl->i2c_channel;
+			pChnl->scale_zero = pOldChnl->scale_zero;
+			pChnl->scale_max = pOldChnl->scale_max;
+			pChnl->enabled = pOldChnl->enabled;
+			pChnl->type = pOldChnl->type;
+			pChnl->function = pOldChnl->function;
+			pChnl->quantise = pOldChnl->quantise;
+			pChnl->transpose = pOldChnl->transpose;
+			pChnl->octaves = pOldChnl->octaves;
+			pChnl->vc_type = pOldChnl->vc_type;
+			for(step = 0; step < MAX_STEPS; step++){
+				pOldStep = &pOldChnl->steps[step];
+				pStep = &pChnl->steps[step];
+				pStep->raw_value = pOldStep->raw_value;
+				pStep->scaled_value = pOldStep->scaled_value;
+				pStep->slew_type = pOldStep->slew_type;
+				pStep->slew_shape = pOldStep->slew_shape;
+				pStep->slew_length = pOldStep->slew_length;
+				pStep->gate_type = pOldStep->gate_type;
+				pStep->ratchets = pOldStep->ratchets;
+				pStep->fill = pOldStep->fill;
+				pStep->rotation = 0;
+				pStep->repetitions = pOldStep->repetitions;
+			}
+		}
+	}
+	free(pOld);
+	return 0;
+}
+
+/*
+ * SEQUENCE_LOAD
+ * Reads the passed sequence file, in either the current or the
+ * old raw format. The sequence is only replaced if the whole file
+ * reads OK. Returns 0 on success, -1 on failure
+ */
+int sequence_load(const char *filename)
+{
+	uint8_t header[SEQ_HEADER_SIZE];
+	struct europi *pSeq;
+	int ret;
+	FILE *file = fopen(filename, "rb");
+	if(file == NULL) return -1;
+	pSeq = malloc(sizeof(struct europi));
+	if(pSeq == NULL){
+		fclose(file);
+		return -1;
+	}
+	memcpy(pSeq, &Europi, sizeof(struct europi));
+	if((fread(header, SEQ_HEADER_SIZE, 1, file) == 1) && (memcmp(header, SEQ_MAGIC, 4) == 0)){
+		ret = sequence_read(file, header, pSeq);
+	}
+	else {
+		ret = sequence_read_legacy(file, pSeq);
+	}
+	fclose(file);
+	if(ret == 0){
+		memcpy(&Europi, pSeq, sizeof(struct europi));
+		plan_publish_all();
+	}
+	free(pSeq);
+	return ret;
+}
@@ -0,0 +1,240 @@
+// Copyright 2016 Richard R. Goodwin / Audio Morphology
+//
+// Author: Richard R. Goodwin (richard.goodwin@morphology.co.uk)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+
+
+/*
+ * Song / Pattern bank
+ *
+ * Europi.tracks is the working copy of the Pattern being played
+ * and edited. Storing a Pattern snapshots it into Track blocks,
+ * sharing any block that hasn't changed since it was loaded, so
+ * copying Patterns and storing small edits is cheap.
+ *
+ * Queuing a Pattern has its output plans built straight away (see
+ * plan_cue() in europi_plan.c), and the clock switches every Track
+ * to it on the bar, with no gap. pattern_dispatch() then catches
+ * the working copy up from the main loop.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "europi.h"
+
+extern struct europi Europi;
+
+struct sequence Song;
+
+/* Blocks the working copy was loaded from - an unchanged Track is stored by sharing its block */
+static struct track_block *loaded_blocks[MAX_TRACKS];
+
+/*
+ * BLOCK_RELEASE
+ * Drops one reference to a block, freeing it once nothing uses it
+ */
+static void block_release(struct track_block *pBlock)
+{
+	if(pBlock == NULL) return;
+	if(--pBlock->refs <= 0) free(pBlock);
+}
+
+/*
+ * TRACK_DIRECTION
+ * Pendulum_B is just the second half of a Pendulum - as far as the
+ * stored Pattern is concerned it's the same direction as Pendulum_F
+ */
+static enum track_dir_t track_direction(enum track_dir_t direction)
+{
+	return (direction == Pendulum_B) ? Pendulum_F : direction;
+}
+
+/*
+ * BLOCK_MATCHES
+ * Whether the edit fields of the passed Track match those stored in
+ * the block. UI state such as the selected flag is ignored
+ */
+static int block_matches(const struct track_block *pBlock, const struct track *pTrack)
+{
+	if(pBlock->track.last_step != pTrack->last_step) return FALSE;
+	if(pBlock->track.direction != track_direction(pTrack->direction)) return FALSE;
+	if(pBlock->track.seed != pTrack->seed) return FALSE;
+	if(memcmp(&pBlock->track.ad_adsr, &pTrack->ad_adsr, sizeof(struct ad_adsr_t)) != 0) return FALSE;
+	return (memcmp(pBlock->track.channels, pTrack->channels, sizeof(pTrack->channels)) == 0) ? TRUE : FALSE;
+}
+
+/*
+ * SONG_INIT
+ * Empties the Pattern bank. The working copy becomes Pattern 0
+ */
+void song_init(void)
+{
+	int pattern, track;
+	for(pattern = 0; pattern < MAX_SEQUENCES; pattern++){
+		for(track = 0; track < (MAX_TRACKS); track++){
+			block_release(Song.patterns[pattern].tracks[track]);
+			Song.patterns[pattern].tracks[track] = NULL;
+		}
+		Song.patterns[pattern].sequence_index = pattern;
+		Song.patterns[pattern].chain = -1;
+	}
+	for(track = 0; track < (MAX_TRACKS); track++){
+		block_release(loaded_blocks[track]);
+		loaded_blocks[track] = NULL;
+	}
+	Song.current_pattern = 0;
+	Song.next_pattern = -1;
+}
+
+/*
+ * PATTERN_STORE
+ * Stores the working copy (Europi.tracks) as the passed Pattern.
+ * Tracks whose edit fields haven't changed since they were loaded
+ * share their existing block. Returns 0 on success, -1 on failure
+ */
+int pattern_store(int pattern)
+{
+	struct pattern *pPattern;
+	struct track_block *pBlock;
+	int track;
+	if((pattern < 0) || (pattern >= MAX_SEQUENCES)) return -1;
+	pPattern = &Song.patterns[pattern];
+	for(track = 0; track < (MAX_TRACKS); track++){
+		pBlock = loaded_blocks[track];
+		if((pBlock == NULL) || (block_matches(pBlock, &Europi.tracks[track]) == FALSE)){
+			pBlock = malloc(sizeof(struct track_block));
+			if(pBlock == NULL){
+				log_msg("pattern_store: out of memory storing Pattern %d\n", pattern);
+				return -1;
+			}
+			memcpy(&pBlock->track, &Europi.tracks[track], sizeof(struct track));
+			pBlock->track.selected = FALSE;
+			pBlock->track.direction = track_direction(pBlock->track.direction);
+			// The working copy holds one reference
+			pBlock->refs = 1;
+			block_release(loaded_blocks[track]);
+			loaded_blocks[track] = pBlock;
+		}
+		if(pPattern->tracks[track] != pBlock){
+			pBlock->refs++;
+			block_release(pPattern->tracks[track]);
+			pPattern->tracks[track] = pBlock;
+		}
+	}
+	return 0;
+}
+
+/*
+ * PATTERN_COPY
+ * Makes one Pattern a copy of another. Only the block references
+ * are copied - a Track is duplicated when one of them is edited
+ * and stored. Returns 0 on success, -1 if there's nothing to copy
+ */
+int pattern_copy(int from, int to)
+{
+	struct track_block *pBlock;
+	int track;
+	if((from < 0) || (from >= MAX_SEQUENCES) || (to < 0) || (to >= MAX_SEQUENCES)) return -1;
+	if(Song.patterns[from].tracks[0] == NULL) return -1;
+	for(track = 0; track < (MAX_TRACKS); track++){
+		pBlock = Song.patterns[from].tracks[track];
+		pBlock->refs++;
+		block_release(Song.patterns[to].tracks[track]);
+		Song.patterns[to].tracks[track] = pBlock;
+	}
+	return 0;
+}
+
+/*
+ * PATTERN_QUEUE
+ * Queues the passed Pattern to start at the next bar, replacing
+ * anything already queued. A Pattern that has never been stored
+ * starts as a copy of the current one. Returns 0 on success, -1
+ * on failure (try again once pattern_dispatch() has run)
+ */
+int pattern_queue(int pattern)
+{
+	const struct track *tracks[MAX_TRACKS];
+	int track;
+	if((pattern < 0) || (pattern >= MAX_SEQUENCES)) return -1;
+	if(pattern_store(Song.current_pattern) != 0) return -1;
+	if((Song.patterns[pattern].tracks[0] == NULL) && (pattern_copy(Song.current_pattern, pattern) != 0)) return -1;
+	for(track = 0; track < (MAX_TRACKS); track++){
+		tracks[track] = &Song.patterns[pattern].tracks[track]->track;
+	}
+	if(plan_cue(tracks) != 0) return -1;
+	Song.next_pattern = pattern;
+	return 0;
+}
+
+/*
+ * PATTERN_CHAIN
+ * Sets the Pattern the passed one is followed by, -1 to have it
+ * just keep repeating. Chaining the Pattern that's playing queues
+ * the next one straight away, if nothing else is queued. Returns
+ * 0 on success, -1 on failure
+ */
+int pattern_chain(int pattern, int chain)
+{
+	if((pattern < 0) || (pattern >= MAX_SEQUENCES)) return -1;
+	if((chain < -1) || (chain >= MAX_SEQUENCES)) return -1;
+	Song.patterns[pattern].chain = chain;
+	if((chain >= 0) && (pattern == Song.current_pattern) && (Song.next_pattern < 0)) return pattern_queue(chain);
+	return 0;
+}
+
+/*
+ * PATTERN_DISPATCH
+ * Called from the main loop. Once the clock has switched to the
+ * queued Pattern, stores any edits to the old Pattern and loads
+ * the new one into the working copy, then queues whatever the new
+ * Pattern is chained to
+ */
+void pattern_dispatch(void)
+{
+	struct pattern *pPattern;
+	struct track_block *pBlock;
+	int track, selected;
+	if(plan_cue_taken() == FALSE) return;
+	plan_lock();
+	pattern_store(Song.current_pattern);
+	pPattern = &Song.patterns[Song.next_pattern];
+	for(track = 0; track < (MAX_TRACKS); track++){
+		pBlock = pPattern->tracks[track];
+		if(pBlock != loaded_blocks[track]){
+			// Selection belongs to the UI, not the Pattern
+			selected = Europi.tracks[track].selected;
+			memcpy(&Europi.tracks[track], &pBlock->track, sizeof(struct track));
+			Europi.tracks[track].selected = selected;
+			pBlock->refs++;
+			block_release(loaded_blocks[track]);
+			loaded_blocks[track] = pBlock;
+		}
+	}
+	Song.current_pattern = Song.next_pattern;
+	Song.next_pattern = -1;
+	plan_cue_done();
+	plan_unlock();
+	if(pPattern->chain >= 0) pattern_queue(pPattern->chain);
+}